@@ -0,0 +1,97 @@
+#pragma once
+
+#include "../common/math/vec2.h"
+#include "../common/math/vec3.h"
+
+#include "CollisionDetertionParameters.h"
+
+namespace SP {
+#if defined(__AVX__)
+    constexpr int CLOSEST_POINT_SIMD_WIDTH = 8;
+#else
+    constexpr int CLOSEST_POINT_SIMD_WIDTH = 4;
+#endif
+
+    // vectorized closestPointTriangle: computes the closest point from p to N triangles (a, b, c) at once, one triangle per lane
+    // all the Voronoi regions are evaluated for all the lanes, then resolved by masked selection from the last region of
+    // the scalar cascade to the first one, so that each lane ends up with the same region as the scalar version
+    // outputs the closest point, and per lane barycentrics, ClosestPointOnTriangleType (as int) and distance to p
+    template<int N>
+    inline embree::Vec3<embree::vfloat<N>> closestPointTriangleN(const embree::Vec3<embree::vfloat<N>>& p,
+        const embree::Vec3<embree::vfloat<N>>& a, const embree::Vec3<embree::vfloat<N>>& b, const embree::Vec3<embree::vfloat<N>>& c,
+        embree::Vec3<embree::vfloat<N>>& baryCentrics, embree::vint<N>& pointType, embree::vfloat<N>& distance)
+    {
+        typedef embree::vfloat<N> vfloatN;
+        typedef embree::vboolf<N> vboolN;
+        typedef embree::vint<N> vintN;
+        typedef embree::Vec3<embree::vfloat<N>> Vec3vfN;
+
+        const vfloatN zero(0.f);
+        const vfloatN one(1.f);
+
+        const Vec3vfN ab = b - a;
+        const Vec3vfN ac = c - a;
+        const Vec3vfN ap = p - a;
+        const vfloatN d1 = dot(ab, ap);
+        const vfloatN d2 = dot(ac, ap);
+
+        const Vec3vfN bp = p - b;
+        const vfloatN d3 = dot(ab, bp);
+        const vfloatN d4 = dot(ac, bp);
+
+        const Vec3vfN cp = p - c;
+        const vfloatN d5 = dot(ab, cp);
+        const vfloatN d6 = dot(ac, cp);
+
+        const vfloatN vc = d1 * d4 - d3 * d2;
+        const vfloatN vb = d5 * d2 - d1 * d6;
+        const vfloatN va = d3 * d6 - d5 * d4;
+
+        // interior, the fall back region of the cascade
+        const vfloatN denom = one / (va + vb + vc);
+        const vfloatN vInterior = vb * denom;
+        const vfloatN wInterior = vc * denom;
+        Vec3vfN closestPt = a + vInterior * ab + wInterior * ac;
+        baryCentrics = Vec3vfN(one - vInterior - wInterior, vInterior, wInterior);
+        pointType = vintN(int(ClosestPointOnTriangleType::AtInterior));
+
+        // the divisions of the edge regions are only kept for the lanes actually in those regions
+        const vboolN atBC = (va <= zero) & ((d4 - d3) >= zero) & ((d5 - d6) >= zero);
+        const vfloatN vBC = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        closestPt = select(atBC, b + vBC * (c - b), closestPt);
+        baryCentrics = select(atBC, Vec3vfN(zero, one - vBC, vBC), baryCentrics);
+        pointType = select(atBC, vintN(int(ClosestPointOnTriangleType::AtBC)), pointType);
+
+        const vboolN atAC = (vb <= zero) & (d2 >= zero) & (d6 <= zero);
+        const vfloatN vAC = d2 / (d2 - d6);
+        closestPt = select(atAC, a + vAC * ac, closestPt);
+        baryCentrics = select(atAC, Vec3vfN(one - vAC, zero, vAC), baryCentrics);
+        pointType = select(atAC, vintN(int(ClosestPointOnTriangleType::AtAC)), pointType);
+
+        const vboolN atAB = (vc <= zero) & (d1 >= zero) & (d3 <= zero);
+        const vfloatN vAB = d1 / (d1 - d3);
+        closestPt = select(atAB, a + vAB * ab, closestPt);
+        baryCentrics = select(atAB, Vec3vfN(one - vAB, vAB, zero), baryCentrics);
+        pointType = select(atAB, vintN(int(ClosestPointOnTriangleType::AtAB)), pointType);
+
+        const vboolN atC = (d6 >= zero) & (d5 <= d6);
+        closestPt = select(atC, c, closestPt);
+        baryCentrics = select(atC, Vec3vfN(zero, zero, one), baryCentrics);
+        pointType = select(atC, vintN(int(ClosestPointOnTriangleType::AtC)), pointType);
+
+        const vboolN atB = (d3 >= zero) & (d4 <= d3);
+        closestPt = select(atB, b, closestPt);
+        baryCentrics = select(atB, Vec3vfN(zero, one, zero), baryCentrics);
+        pointType = select(atB, vintN(int(ClosestPointOnTriangleType::AtB)), pointType);
+
+        const vboolN atA = (d1 <= zero) & (d2 <= zero);
+        closestPt = select(atA, a, closestPt);
+        baryCentrics = select(atA, Vec3vfN(one, zero, zero), baryCentrics);
+        pointType = select(atA, vintN(int(ClosestPointOnTriangleType::AtA)), pointType);
+
+        const Vec3vfN diff = p - closestPt;
+        distance = sqrt(dot(diff, diff));
+
+        return closestPt;
+    }
+}
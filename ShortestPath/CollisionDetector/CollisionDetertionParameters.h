@@ -52,9 +52,65 @@ namespace SP {
         bool useStaticTraverse = true;
         bool restPoseCloestPoint = false;
         bool loopLessTraverse = false;
+        // exact loop detection of the static and dynamic traverses with per-thread visited stamps, not used with loopLessTraverse
+        bool exactTraversedTets = false;
+        // the tetrahedral traverses read the packed per tet topology records (TetMeshFEM::tetTopologyRecords)
+        bool packedTetTopology = false;
+        // the tetrahedral traverses select the exit faces with the SIMD kernel of TetExitFaceSIMD.h
+        bool simdExitFaceKernel = false;
+        // the tetrahedral traverses select the exit faces by Plucker side products, has priority over simdExitFaceKernel
+        bool pluckerTraverse = false;
+        // where the ray branches, the most centrally crossed exit face is explored first
+        // the verdict may differ where a speculative branch reaches the boundary before the target
+        bool bestFirstBranchOrder = false;
+        // detectAll runs the tet inclusion query for all the vertices before the closest point query
+        bool twoPhaseBatchQuery = false;
+        // the surface BVH leaves are clusters of neighboring faces evaluated at once by SIMD, not used with restPoseCloestPoint
+        bool leafBatchedClosestPoint = false;
+        // refresh the per-step tet face plane and volume cache (TetMeshFEM::updateTetGeometryCache) in updateBVH
+        bool cacheTetGeometry = false;
+        // refresh the per-step surface normal cache (TetMeshFEM::updateSurfaceNormalCache) in updateBVH
+        bool cacheSurfaceNormals = false;
+        // refresh 16 byte aligned vertex positions (TetMeshFEM::updateAlignedVertexStorage) in updateBVH, shared with Embree
+        bool alignedVertexStorage = false;
+        // the feasible region check reads per-step precomputed half spaces (DiscreteCollisionDetector::feasibleRegionTables)
+        bool useFeasibleRegionTable = false;
+        // with leafBatchedClosestPoint, skip the face clusters whose normal cone excludes the query point
+        bool normalConePruning = false;
+        // gather the nearest feasible candidates, then traverse them from the nearest one, not used with restPoseCloestPoint
+        bool lazyClosestPointValidation = false;
+        // number of candidates gathered by the first round of lazyClosestPointValidation, doubled at each next round
+        // each round has its own maxNumberOfBVHQuery, a query whose round is given up falls back to the eager validation
+        int lazyValidationQueueSize = 1;
+        // lazyClosestPointValidation traverses the candidates in packets (TetMeshFEM::tetrahedralTraversePacket)
+        // the candidates behind the nearest success of a packet are traversed too
+        bool packetTraverse = false;
+        // lazy validation with twoPhaseBatchQuery interleaves the traversals of wavefrontSize records, over packetTraverse
+        bool wavefrontTraverse = false;
+        int wavefrontSize = 32;
+        // vertexCollisionDetection first walks from the embracing tets of the last step before querying the BVH
+        // a vertex misses the tets newly embracing it until its next BVH query
+        bool warmStartEmbracingTets = false;
+        // max number of tets visited by each walk of warmStartEmbracingTets
+        int warmStartWalkBudget = 8;
+        // max number of consecutive warm started steps before the BVH query of a vertex is forced
+        int warmStartRefreshInterval = 4;
+        // the closest point query radius starts from the last step's closest face
+        // not used with restPoseCloestPoint and lazyClosestPointValidation
+        bool warmStartClosestPointRadius = false;
+        // cache the tet traversal verdicts of the closest point query for the current step
+        bool cacheTraversalVerdicts = false;
+        // log2 of the number of entries of the traversal verdict cache of each mesh
+        int traversalVerdictCacheLog2Size = 16;
+        // the tet mesh scene uses a user defined tet primitive tested against cached face planes, implies cacheTetGeometry
+        bool useTetFacePlanePrimitive = false;
+        // twoPhaseBatchQuery gathers the candidates of the penetrations sharing an embracing tet with a single BVH query
+        // verdicts are only shared through cacheTraversalVerdicts; not used with restPoseCloestPoint and lazyClosestPointValidation
+        bool groupQueriesByEmbracingTet = false;
 
         bool shiftQueryPointToCenter = true;
         float centerShiftLevel = 0.01f;
+        // budget of the BVH callbacks of the closest point query of each (vertex, embracing tet) pair
         int maxNumberOfBVHQuery = 500;
 
         int numberOfBVHQuery = 0;
@@ -85,6 +141,31 @@ namespace SP {
 
             EXTRACT_FROM_JSON(collisionParam, restPoseCloestPoint);
             EXTRACT_FROM_JSON(collisionParam, loopLessTraverse);
+            EXTRACT_FROM_JSON(collisionParam, exactTraversedTets);
+            EXTRACT_FROM_JSON(collisionParam, packedTetTopology);
+            EXTRACT_FROM_JSON(collisionParam, simdExitFaceKernel);
+            EXTRACT_FROM_JSON(collisionParam, pluckerTraverse);
+            EXTRACT_FROM_JSON(collisionParam, bestFirstBranchOrder);
+            EXTRACT_FROM_JSON(collisionParam, twoPhaseBatchQuery);
+            EXTRACT_FROM_JSON(collisionParam, leafBatchedClosestPoint);
+            EXTRACT_FROM_JSON(collisionParam, cacheTetGeometry);
+            EXTRACT_FROM_JSON(collisionParam, useTetFacePlanePrimitive);
+            EXTRACT_FROM_JSON(collisionParam, cacheSurfaceNormals);
+            EXTRACT_FROM_JSON(collisionParam, alignedVertexStorage);
+            EXTRACT_FROM_JSON(collisionParam, useFeasibleRegionTable);
+            EXTRACT_FROM_JSON(collisionParam, normalConePruning);
+            EXTRACT_FROM_JSON(collisionParam, lazyClosestPointValidation);
+            EXTRACT_FROM_JSON(collisionParam, lazyValidationQueueSize);
+            EXTRACT_FROM_JSON(collisionParam, packetTraverse);
+            EXTRACT_FROM_JSON(collisionParam, wavefrontTraverse);
+            EXTRACT_FROM_JSON(collisionParam, wavefrontSize);
+            EXTRACT_FROM_JSON(collisionParam, warmStartEmbracingTets);
+            EXTRACT_FROM_JSON(collisionParam, warmStartWalkBudget);
+            EXTRACT_FROM_JSON(collisionParam, warmStartRefreshInterval);
+            EXTRACT_FROM_JSON(collisionParam, warmStartClosestPointRadius);
+            EXTRACT_FROM_JSON(collisionParam, cacheTraversalVerdicts);
+            EXTRACT_FROM_JSON(collisionParam, traversalVerdictCacheLog2Size);
+            EXTRACT_FROM_JSON(collisionParam, groupQueriesByEmbracingTet);
 
 
 
@@ -110,6 +191,31 @@ namespace SP {
 
             PUT_TO_JSON(collisionParam, restPoseCloestPoint);
             PUT_TO_JSON(collisionParam, loopLessTraverse);
+            PUT_TO_JSON(collisionParam, exactTraversedTets);
+            PUT_TO_JSON(collisionParam, packedTetTopology);
+            PUT_TO_JSON(collisionParam, simdExitFaceKernel);
+            PUT_TO_JSON(collisionParam, pluckerTraverse);
+            PUT_TO_JSON(collisionParam, bestFirstBranchOrder);
+            PUT_TO_JSON(collisionParam, twoPhaseBatchQuery);
+            PUT_TO_JSON(collisionParam, leafBatchedClosestPoint);
+            PUT_TO_JSON(collisionParam, cacheTetGeometry);
+            PUT_TO_JSON(collisionParam, useTetFacePlanePrimitive);
+            PUT_TO_JSON(collisionParam, cacheSurfaceNormals);
+            PUT_TO_JSON(collisionParam, alignedVertexStorage);
+            PUT_TO_JSON(collisionParam, useFeasibleRegionTable);
+            PUT_TO_JSON(collisionParam, normalConePruning);
+            PUT_TO_JSON(collisionParam, lazyClosestPointValidation);
+            PUT_TO_JSON(collisionParam, lazyValidationQueueSize);
+            PUT_TO_JSON(collisionParam, packetTraverse);
+            PUT_TO_JSON(collisionParam, wavefrontTraverse);
+            PUT_TO_JSON(collisionParam, wavefrontSize);
+            PUT_TO_JSON(collisionParam, warmStartEmbracingTets);
+            PUT_TO_JSON(collisionParam, warmStartWalkBudget);
+            PUT_TO_JSON(collisionParam, warmStartRefreshInterval);
+            PUT_TO_JSON(collisionParam, warmStartClosestPointRadius);
+            PUT_TO_JSON(collisionParam, cacheTraversalVerdicts);
+            PUT_TO_JSON(collisionParam, traversalVerdictCacheLog2Size);
+            PUT_TO_JSON(collisionParam, groupQueriesByEmbracingTet);
 
 
             return true;
@@ -131,6 +237,8 @@ namespace SP {
 
     struct DiscreteCollisionDetector;
 
+    // DiscreteCollisionDetector::vertexCollisionDetection and closestPointQuery fill it with the original vertex, tet and surface
+    // face ids of the meshes reordered for locality (ObjectParams::reorderForLocality)
     struct CollisionDetectionResult
     {
         CollisionDetectionResult()
@@ -145,6 +253,7 @@ namespace SP {
             closestSurfacePts.clear();
             closestSurfacePtBarycentrics.clear();
             closestPointType.clear();
+            closestPointNormals.clear();
 
             numberOfBVHQuery = 0;
             numberOfTetTraversal = 0;
@@ -2,6 +2,13 @@
 #include <CuMatrix/MatrixOps/CuMatrix.h>
 #include <CuMatrix/Geometry/Geometry.h>
 #include "../TetMesh/TetMeshFEM.h"
+#include "../Parallelization/CPUParallelization.h"
+#include "../common/algorithms/parallel_prefix_sum.h"
+#include "../common/algorithms/parallel_sort.h"
+#include "ClosestPointTriangleSIMD.h"
+#include "../common/math/bbox.h"
+
+#include <algorithm>
 
 using namespace SP;
 using embree::Vec3fa;
@@ -10,11 +17,29 @@ using embree::Vec3fa;
 
 inline embree::Vec3fa SP::loadVertexPos(TetMeshFEM* pTM, int32_t vId)
 {
+    if (pTM->alignedVertexStorageEnabled)
+    {
+        return pTM->alignedVertPos[vId];
+    }
     return embree::Vec3fa::loadu(pTM->mVertPos.col(vId).data());
 }
 
+inline embree::Vec3fa SP::loadRestposeVertexPos(TetMeshFEM* pTM, int32_t vId)
+{
+    if (pTM->alignedVertexStorageEnabled)
+    {
+        return pTM->alignedRestposeVerts[vId];
+    }
+    return embree::Vec3fa::loadu(pTM->restposeVerts.col(vId).data());
+}
+
 inline embree::Vec3fa SP::faceNormal(TetMeshFEM* pTM, int32_t faceId)
 {
+    if (pTM->surfaceNormalCacheEnabled)
+    {
+        return embree::Vec3fa(pTM->surfaceFaceNormals(0, faceId), pTM->surfaceFaceNormals(1, faceId), pTM->surfaceFaceNormals(2, faceId));
+    }
+
     embree::Vec3fa a = loadVertexPos(pTM, pTM->surfaceFacesTetMeshVIds(0, faceId)),
         b = loadVertexPos(pTM, pTM->surfaceFacesTetMeshVIds(1, faceId)),
         c = loadVertexPos(pTM, pTM->surfaceFacesTetMeshVIds(2, faceId));
@@ -112,6 +137,52 @@ Vec3fa SP::closestPointTriangle(Vec3fa const& p, Vec3fa const& a, Vec3fa const&
     return a + v * ab + w * ac;
 }
 
+// signed distances (unnormalized) of the point to 4 planes stored in the layout of TPlanes4Mat
+inline embree::vfloat4 planes4SignedDistances(float x, float y, float z, const FloatingType* planes)
+{
+    return embree::madd(embree::vfloat4::load(planes), embree::vfloat4(x),
+        embree::madd(embree::vfloat4::load(planes + 4), embree::vfloat4(y),
+            embree::madd(embree::vfloat4::load(planes + 8), embree::vfloat4(z), embree::vfloat4::load(planes + 12))));
+}
+
+// tests the point against the 4 cached face planes of a tet at once (see TetMeshFEM::tetFacePlanes)
+inline bool pointInTetFacePlanes(const FloatingType* p, const FloatingType* tetFacePlanes)
+{
+    return embree::all(planes4SignedDistances(p[0], p[1], p[2], tetFacePlanes) < embree::vfloat4(0.f));
+}
+
+// the inclusion test of the tet mesh scene
+inline bool pointInTet(TetMeshFEM* pTM, const FloatingType* p, int32_t tetId)
+{
+    if (pTM->tetGeometryCacheEnabled)
+    {
+        return pointInTetFacePlanes(p, pTM->tetFacePlanes.col(tetId).data());
+    }
+    else
+    {
+        return CuMatrix::tetPointInTet((FloatingType*)p, pTM->mVertPos.data(), pTM->mTetVIds.col(tetId).data());
+    }
+}
+
+void tetBoundsFunc(const RTCBoundsFunctionArguments* args)
+{
+    TetMeshFEM* pTM = (TetMeshFEM*)args->geometryUserPtr;
+
+    embree::BBox3fa bounds(embree::empty);
+    for (int iV = 0; iV < 4; iV++)
+    {
+        bounds.extend(loadVertexPos(pTM, pTM->mTetVIds(iV, args->primID)));
+    }
+
+    RTCBounds* bounds_o = args->bounds_o;
+    bounds_o->lower_x = bounds.lower.x;
+    bounds_o->lower_y = bounds.lower.y;
+    bounds_o->lower_z = bounds.lower.z;
+    bounds_o->upper_x = bounds.upper.x;
+    bounds_o->upper_y = bounds.upper.y;
+    bounds_o->upper_z = bounds.upper.z;
+}
+
 bool tetIntersectionFunc(RTCPointQueryFunctionArguments* args)
 {
     CollisionDetectionResult* result = (CollisionDetectionResult*)args->userPtr;
@@ -172,7 +243,7 @@ bool tetIntersectionFunc(RTCPointQueryFunctionArguments* args)
     }
 
     FloatingType p[3] = { args->query->x, args->query->y, args->query->z };
-    if (CuMatrix::tetPointInTet(p, pTMIntersected->mVertPos.data(), tetVIds)) {
+    if (pointInTet(pTMIntersected, p, intersectedTId)) {
         result->intersectedTets.push_back(intersectedTId);
         result->intersectedTMeshIds.push_back(geomID);
 
@@ -181,45 +252,436 @@ bool tetIntersectionFunc(RTCPointQueryFunctionArguments* args)
 
 }
 
-bool closestPointQueryFunc(RTCPointQueryFunctionArguments* args)
+inline uint64_t mixBits64(uint64_t x)
 {
-    ClosestPointQueryResult* result = (ClosestPointQueryResult*)args->userPtr;
-    // TetMeshFEM* pTMQuery = result->pDCD->tMeshPtrs[result->idTMQuery].get();
-    ++result->numberOfBVHQuery;
-    if (result->numberOfBVHQuery > result->pDCD->params.maxNumberOfBVHQuery) {
-        result->found = false;
-        args->query->radius = 0;
+    // splitmix64 finalizer
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// hash of the key of the traversal verdict cache, the unit ray direction is quantized by octahedral mapping to 8 bits per axis
+inline uint64_t traversalVerdictKeyHash(int32_t faceId, int32_t targetTetId, const Vec3fa& rayDirection)
+{
+    float l1Norm = fabsf(rayDirection.x) + fabsf(rayDirection.y) + fabsf(rayDirection.z);
+    float u = rayDirection.x / l1Norm;
+    float v = rayDirection.y / l1Norm;
+    if (rayDirection.z < 0.f)
+    {
+        float uFolded = (1.f - fabsf(v)) * (u >= 0.f ? 1.f : -1.f);
+        v = (1.f - fabsf(u)) * (v >= 0.f ? 1.f : -1.f);
+        u = uFolded;
+    }
+    uint64_t uQuantized = uint64_t(std::min(255.f, (u * 0.5f + 0.5f) * 256.f));
+    uint64_t vQuantized = uint64_t(std::min(255.f, (v * 0.5f + 0.5f) * 256.f));
+
+    return mixBits64((uint64_t(uint32_t(faceId)) << 32 | uint32_t(targetTetId)) ^ mixBits64((uQuantized << 8 | vQuantized) + 1));
+}
+
+// the ray of the tetrahedral traverse from the closest point candidate on surface face faceId of mesh meshId to the query point
+void closestPointTraverseRay(ClosestPointQueryResult* result, int32_t meshId, int32_t faceId, const Vec3fa& queryPt,
+    const Vec3fa& closestP, ClosestPointOnTriangleType pointType, TetTraverseRay& ray)
+{
+    DiscreteCollisionDetector* pDCD = result->pDCD;
+    TetMeshFEM* pTMSearch = pDCD->tMeshPtrs[meshId].get();
+    embree::Vec3ia face(pTMSearch->surfaceFacesTetMeshVIds(0, faceId), pTMSearch->surfaceFacesTetMeshVIds(1, faceId), pTMSearch->surfaceFacesTetMeshVIds(2, faceId));
+
+    // query point traverse to closest point
+    //PathFinder::CPoint rayDirection = (closestP - qq);
+    //pathFinder->markDesination(intersectionType, result->pMeshClosestElement);
+    //bool hasValidTraverse = pathFinder->rayTMeshTraverse(result->pEmbraceTet, qq, rayDirection, closestP, intersectionType,
+    //   result->pMeshClosestElement, result->traversedTVec );
+    //pathFinder->unmarkDesination(intersectionType, result->pMeshClosestElement);
+
+    // closest point traverse to query point
+    // we move it a little bit to the center of the triangles to avoid intersecting with edges/vertices at the first tet
+
+    Vec3fa closestPTracing;
+    if (pointType == ClosestPointOnTriangleType::AtInterior)
+    {
+        closestPTracing = closestP ;
+    }
+    else {
+        embree::Vec3fa a = loadVertexPos(pTMSearch, face[0]);
+        embree::Vec3fa b = loadVertexPos(pTMSearch, face[1]);
+        embree::Vec3fa c = loadVertexPos(pTMSearch, face[2]);
+        closestPTracing = closestP * (1.f - pDCD->params.centerShiftLevel) + (pDCD->params.centerShiftLevel / 3.0f) * (a + b + c);
+
+    }
+
+    Vec3fa targetPt;
+    if (pDCD->params.shiftQueryPointToCenter)
+    {
+        Vec3fa tetCentroid;
+        CuMatrix::tetCentroid(&tetCentroid.x, pTMSearch->mVertPos.data(), pTMSearch->mTetVIds.col(result->idEmbraceTet).data());
+
+        targetPt = (1.f - pDCD->params.centerShiftLevel) * queryPt + pDCD->params.centerShiftLevel * tetCentroid;
+    }
+    else {
+        targetPt = queryPt;
+    }
+    // traversing from the surface triangle to the query point
+    Vec3fa rayDirection = (targetPt - closestPTracing);
+    FloatingType rayLength = embree::length(rayDirection);
+    rayDirection = rayDirection / rayLength;
+
+    if (pDCD->params.stopTraversingAfterPassingQueryPoint)
+    {
+        ray.maxTraversalDis = pDCD->params.maxSearchDistanceMultiplier * rayLength;
+    }
+    else
+    {
+        ray.maxTraversalDis = -1.f;
+    }
+
+    ray.startFaceId = pTMSearch->surfaceFacesIdAtBelongingTets(faceId);
+    ray.startTetId = pTMSearch->surfaceFacesBelongingTets(faceId);
+    ray.targetTetId = result->idEmbraceTet;
+
+    ray.origin << closestPTracing.x, closestPTracing.y, closestPTracing.z;
+    ray.dir << rayDirection.x, rayDirection.y, rayDirection.z;
+}
+
+// the key of the traversal verdict cache of the ray of closestPointTraverseRay
+inline uint64_t closestPointTraverseVerdictKeyHash(ClosestPointQueryResult* result, int32_t faceId, const TetTraverseRay& ray)
+{
+    return traversalVerdictKeyHash(faceId, result->idEmbraceTet, Vec3fa(ray.dir(0), ray.dir(1), ray.dir(2)));
+}
+
+// calls traverse(TraversePolicies<...>()) with the policies of the tetrahedral traverse selected by params
+template<typename Traverse>
+inline void dispatchTraversePolicies(const CollisionDetectionParamters& params, Traverse&& traverse)
+{
+    if (params.loopLessTraverse)
+    {
+        traverse(TraversePolicies<TraverseStackDynamic, TraverseVisitedNone, TraverseForwardCheck>());
+    }
+    else if (params.useStaticTraverse && params.exactTraversedTets)
+    {
+        traverse(TraversePolicies<TraverseStackSpill, TraverseVisitedEpoch, TraverseNoForwardCheck>());
+    }
+    else if (params.useStaticTraverse)
+    {
+        // the candidate stack spills to the heap when full, instead of restarting with the dynamic traverse
+        traverse(TraversePolicies<TraverseStackSpill, TraverseVisitedDefault, TraverseNoForwardCheck>());
+    }
+    else if (params.exactTraversedTets)
+    {
+        traverse(TraversePolicies<TraverseStackDynamic, TraverseVisitedEpoch, TraverseNoForwardCheck>());
+    }
+    else
+    {
+        traverse(TraversePolicies<TraverseStackDynamic, TraverseVisitedDefault, TraverseNoForwardCheck>());
+    }
+}
+
+// accounts a finished tetrahedral traverse of the closest point query
+void recordClosestPointTraverse(ClosestPointQueryResult* result, int32_t meshId, const TetTraverseRay& ray, const Vec3fa& queryPt,
+    bool sucess, const TraverseStatistics& traverseStatistics, uint64_t verdictKeyHash)
+{
+    DiscreteCollisionDetector* pDCD = result->pDCD;
+
+    if (!sucess && traverseStatistics.stopReason == TraverseStopReason::emptyStack
+        && (pDCD->params.loopLessTraverse || pDCD->params.useStaticTraverse))
+    {
+        std::cout << "Empty stack (dead end) encountered!!! A ray is dicarded!!! \n";
+        std::cout << "Ray source: " << ray.origin.transpose() << " | ray target: " << queryPt << "\n";
+    }
+
+    result->numberOfTetsTraversed += traverseStatistics.numTetsTraversed;
+
+    // a traversal stopped by the max search distance depends on the ray length, which is not part of the key
+    if (pDCD->params.cacheTraversalVerdicts && traverseStatistics.stopReason != TraverseStopReason::passedMaximumDis)
+    {
+        pDCD->traversalVerdictCaches[meshId].insert(verdictKeyHash, sucess);
+    }
+}
+
+// tetrahedral traverse from the closest point candidate on surface face faceId of mesh meshId to the query point,
+// succeeds if the embracing tet of the query point is reached
+bool tetTraverseFromClosestPoint(ClosestPointQueryResult* result, int32_t meshId, int32_t faceId, const Vec3fa& queryPt,
+    const Vec3fa& closestP, ClosestPointOnTriangleType pointType)
+{
+    DiscreteCollisionDetector* pDCD = result->pDCD;
+    TetMeshFEM* pTMSearch = pDCD->tMeshPtrs[meshId].get();
+
+    TetTraverseRay ray;
+    closestPointTraverseRay(result, meshId, faceId, queryPt, closestP, pointType, ray);
+
+    uint64_t verdictKeyHash = 0;
+    if (pDCD->params.cacheTraversalVerdicts)
+    {
+        verdictKeyHash = closestPointTraverseVerdictKeyHash(result, faceId, ray);
+        int verdict = pDCD->traversalVerdictCaches[meshId].lookup(verdictKeyHash);
+        if (verdict != -1)
+        {
+            return verdict == 1;
+        }
+    }
+
+    ++result->numberOfTetTraversal;
+
+    bool sucess = false;
+
+    TraverseStatistics traverseStatistics;
+
+#ifdef OUTPUT_TRAVERSED_TETS
+    std::vector<int32_t> traversedTetsOutput;
+    TraverseRecordTets instrumentation(traversedTetsOutput);
+#else
+    TraverseNoInstrumentation instrumentation;
+#endif
+    dispatchTraversePolicies(pDCD->params, [&](auto policies) {
+        typedef decltype(policies) Policies;
+        sucess = pTMSearch->tetrahedralTraverse<typename Policies::StackPolicy, typename Policies::VisitedPolicy,
+            typename Policies::ForwardCheckPolicy>(ray.origin, ray.dir, ray.maxTraversalDis, ray.startTetId, ray.startFaceId,
+            ray.targetTetId, pDCD->params.rayTriIntersectionEPSILON, traverseStatistics, instrumentation);
+    });
+
+    recordClosestPointTraverse(result, meshId, ray, queryPt, sucess, traverseStatistics, verdictKeyHash);
+
+    return sucess;
+}
+
+// tetTraverseFromClosestPoint of the numCandidates (up to TET_TRAVERSE_PACKET_WIDTH) candidates at once, with the packet
+// traverse (TetMeshFEM::tetrahedralTraversePacket)
+void tetTraverseFromClosestPoints(ClosestPointQueryResult* result, int32_t meshId, const ClosestPointCandidate* candidates,
+    int32_t numCandidates, const Vec3fa& queryPt, bool* successes)
+{
+    DiscreteCollisionDetector* pDCD = result->pDCD;
+    TetMeshFEM* pTMSearch = pDCD->tMeshPtrs[meshId].get();
+
+    // the rays not answered by the traversal verdict cache
+    TetTraverseRay rays[TET_TRAVERSE_PACKET_WIDTH];
+    int32_t candidateIds[TET_TRAVERSE_PACKET_WIDTH];
+    uint64_t verdictKeyHashes[TET_TRAVERSE_PACKET_WIDTH] = {};
+    int32_t numRays = 0;
+    for (int32_t iCandidate = 0; iCandidate < numCandidates; iCandidate++)
+    {
+        const ClosestPointCandidate& candidate = candidates[iCandidate];
+        TetTraverseRay& ray = rays[numRays];
+        closestPointTraverseRay(result, meshId, candidate.faceId, queryPt, candidate.closestPt, candidate.pointType, ray);
+
+        if (pDCD->params.cacheTraversalVerdicts)
+        {
+            verdictKeyHashes[numRays] = closestPointTraverseVerdictKeyHash(result, candidate.faceId, ray);
+            int verdict = pDCD->traversalVerdictCaches[meshId].lookup(verdictKeyHashes[numRays]);
+            if (verdict != -1)
+            {
+                successes[iCandidate] = verdict == 1;
+                continue;
+            }
+        }
+        candidateIds[numRays++] = iCandidate;
+    }
+    if (!numRays)
+    {
+        return;
+    }
+
+    result->numberOfTetTraversal += numRays;
+
+    bool raySuccesses[TET_TRAVERSE_PACKET_WIDTH];
+    TraverseStatistics traverseStatistics[TET_TRAVERSE_PACKET_WIDTH];
+    dispatchTraversePolicies(pDCD->params, [&](auto policies) {
+        typedef decltype(policies) Policies;
+        pTMSearch->tetrahedralTraversePacket<typename Policies::StackPolicy, typename Policies::VisitedPolicy,
+            typename Policies::ForwardCheckPolicy>(rays, numRays, pDCD->params.rayTriIntersectionEPSILON, raySuccesses,
+            traverseStatistics);
+    });
+
+    for (int32_t iRay = 0; iRay < numRays; iRay++)
+    {
+        successes[candidateIds[iRay]] = raySuccesses[iRay];
+        recordClosestPointTraverse(result, meshId, rays[iRay], queryPt, raySuccesses[iRay], traverseStatistics[iRay],
+            verdictKeyHashes[iRay]);
+    }
+}
+
+// the closest point of the lazy validation is the candidate
+inline void acceptClosestPointCandidate(ClosestPointQueryResult* result, const ClosestPointCandidate& candidate)
+{
+    result->closestFaceId = candidate.faceId;
+    result->closestPt = candidate.closestPt;
+    result->closestPtBarycentrics = candidate.closestPtBarycentrics;
+    result->closestPointType = candidate.pointType;
+    result->found = true;
+}
+
+// wavefrontTraverse: the lazy validation of a block of records of the two phase batch query, the tet traversals of the records
+// intersecting mesh meshId are interleaved by TetMeshFEM::tetrahedralTraverseWavefront
+// each record has at most one ray in the wavefront, thus it validates its candidates from the nearest one until the first
+// success, as closestPointQueryLazy
+struct SP::LazyValidationWavefront : public TetTraverseRaySource
+{
+    bool nextRay(TetTraverseRay& ray, int32_t& rayId) override
+    {
+        while (!readyRecords.empty())
+        {
+            int32_t iRecord = readyRecords.back();
+            readyRecords.pop_back();
+            if (nextCandidateRay(iRecord))
+            {
+                ray = rays[iRecord];
+                rayId = iRecord;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void finishRay(int32_t rayId, bool success, const TraverseStatistics& statistics) override
+    {
+        ClosestPointQueryResult* result = &closestPtResults[rayId];
+        recordClosestPointTraverse(result, meshId, rays[rayId], queryPoint(rayId), success, statistics, verdictKeyHashes[rayId]);
+        if (success)
+        {
+            acceptClosestPointCandidate(result, result->candidates[candidateCursors[rayId]]);
+            return;
+        }
+        ++candidateCursors[rayId];
+        readyRecords.push_back(rayId);
+    }
+
+    // moves the cursor of record iRecord to its next candidate to tet traverse and sets its ray, gathers the next round of
+    // candidates when the current one is exhausted; returns false if the record is finished
+    bool nextCandidateRay(int32_t iRecord)
+    {
+        ClosestPointQueryResult* result = &closestPtResults[iRecord];
+        std::vector<ClosestPointCandidate>& candidates = result->candidates;
+        bool tetTraverse = result->checkTetTraverse
+            && (meshId == result->idTMQuery || pDCD->params.tetrahedralTraverseForNonSelfIntersection);
+        while (true)
+        {
+            if (candidateCursors[iRecord] == candidates.size())
+            {
+                if (gatheredCandidates[iRecord])
+                {
+                    // no farther feasible candidate left
+                    if (candidates.size() < result->candidateQueueSize)
+                    {
+                        return false;
+                    }
+                    result->candidateLowerBound = candidates.back();
+                    result->candidateQueueSize *= 2;
+                }
+                gatheredCandidates[iRecord] = true;
+                candidateCursors[iRecord] = 0;
+                if (!pDCD->gatherClosestPointCandidates(queries[iRecord], meshId, result))
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            const ClosestPointCandidate& candidate = candidates[candidateCursors[iRecord]];
+            if (!tetTraverse)
+            {
+                acceptClosestPointCandidate(result, candidate);
+                return false;
+            }
+
+            TetTraverseRay& ray = rays[iRecord];
+            closestPointTraverseRay(result, meshId, candidate.faceId, queryPoint(iRecord), candidate.closestPt, candidate.pointType,
+                ray);
+            if (pDCD->params.cacheTraversalVerdicts)
+            {
+                verdictKeyHashes[iRecord] = closestPointTraverseVerdictKeyHash(result, candidate.faceId, ray);
+                int verdict = pDCD->traversalVerdictCaches[meshId].lookup(verdictKeyHashes[iRecord]);
+                if (verdict == 1)
+                {
+                    acceptClosestPointCandidate(result, candidate);
+                    return false;
+                }
+                else if (verdict == 0)
+                {
+                    ++candidateCursors[iRecord];
+                    continue;
+                }
+            }
+            ++result->numberOfTetTraversal;
+            return true;
+        }
+    }
+
+    Vec3fa queryPoint(int32_t iRecord) { return Vec3fa(queries[iRecord].x, queries[iRecord].y, queries[iRecord].z); }
+
+    DiscreteCollisionDetector* pDCD = nullptr;
+    int32_t meshId = -1;
+    // - per record of the block
+    std::vector<RTCPointQuery> queries;
+    std::vector<ClosestPointQueryResult> closestPtResults;
+    // - - the candidate being validated in the current round of gathered candidates
+    std::vector<size_t> candidateCursors;
+    std::vector<int8_t> gatheredCandidates;
+    std::vector<TetTraverseRay> rays;
+    std::vector<uint64_t> verdictKeyHashes;
+    // the records of meshId which are not finished and have no ray in the wavefront
+    std::vector<int32_t> readyRecords;
+};
+
+// lazy validation: inserts a feasible candidate into the bounded max heap of result, once the heap is full the query radius
+// shrinks to its farthest candidate
+// returns true if the query radius changed
+bool gatherClosestPointCandidate(RTCPointQueryFunctionArguments* args, ClosestPointQueryResult* result, int32_t faceId,
+    const Vec3fa& closestP, const Vec3fa& closestPtBarycentrics, ClosestPointOnTriangleType pointType, float d)
+{
+    ClosestPointCandidate candidate;
+    candidate.distance = d;
+    candidate.faceId = faceId;
+    candidate.closestPt = closestP;
+    candidate.closestPtBarycentrics = closestPtBarycentrics;
+    candidate.pointType = pointType;
+
+    // already validated by a previous round
+    if (!closestPointCandidateLess(result->candidateLowerBound, candidate))
+    {
+        return false;
+    }
+
+    std::vector<ClosestPointCandidate>& heap = result->candidates;
+    const size_t maxNumCandidates = result->candidateQueueSize;
+    if (heap.size() == maxNumCandidates)
+    {
+        if (!closestPointCandidateLess(candidate, heap.front()))
+        {
+            return false;
+        }
+        std::pop_heap(heap.begin(), heap.end(), closestPointCandidateLess);
+        heap.pop_back();
+    }
+    heap.push_back(candidate);
+    std::push_heap(heap.begin(), heap.end(), closestPointCandidateLess);
+
+    if (heap.size() == maxNumCandidates && heap.front().distance < args->query->radius)
+    {
+        args->query->radius = heap.front().distance;
         return true;
     }
-                                               
+    return false;
+}
+
+// validates a closest point candidate on surface face faceId of mesh args->geomID and, if it is valid and closer than the
+// current query radius, records it in result and shrinks the query radius
+// returns true if the query radius changed
+bool validateClosestPointCandidate(RTCPointQueryFunctionArguments* args, ClosestPointQueryResult* result, int32_t faceId,
+    const Vec3fa& closestP, const Vec3fa& closestPtBarycentrics, ClosestPointOnTriangleType pointType, float d)
+{
     DiscreteCollisionDetector* pDCD = result->pDCD;
 
-    assert(args->userPtr);
     const unsigned int geomID = args->geomID;
-    const unsigned int primID = args->primID;
     TetMeshFEM* pTMSearch = result->pDCD->tMeshPtrs[geomID].get();
 
     embree::Vec3fa queryPt(args->query->x, args->query->y, args->query->z);
-    //PathFinder::CPoint qq = 
-    /*
-     * Get triangle information in local space
-     */
-
-    embree::Vec3ia face(pTMSearch->surfaceFacesTetMeshVIds(0, primID), pTMSearch->surfaceFacesTetMeshVIds(1, primID), pTMSearch->surfaceFacesTetMeshVIds(2, primID));
-
-    embree::Vec3fa a = embree::Vec3fa::loadu(pTMSearch->mVertPos.col(face[0]).data());
-    embree::Vec3fa b = embree::Vec3fa::loadu(pTMSearch->mVertPos.col(face[1]).data());
-    embree::Vec3fa c = embree::Vec3fa::loadu(pTMSearch->mVertPos.col(face[2]).data());
+    embree::Vec3ia face(pTMSearch->surfaceFacesTetMeshVIds(0, faceId), pTMSearch->surfaceFacesTetMeshVIds(1, faceId), pTMSearch->surfaceFacesTetMeshVIds(2, faceId));
 
-    ///*
-    // * Determine distance to closest point on triangle (implemented in
-    // * common/math/closest_point.h), and transform in world space if necessary.
-    // */
-    ClosestPointOnTriangleType pointType;
-    Vec3fa closestPtBarycentrics;
-    Vec3fa closestP = SP::closestPointTriangle(queryPt, a, b, c, closestPtBarycentrics, pointType);
-    float d = embree::distance(queryPt, closestP);
-    // printf_s("Queried triangle with distance: %f\n", d);
+    for (int iFace = 0; iFace < result->numWarmStartRejectedFaces; iFace++)
+    {
+        if (result->warmStartRejectedFaceIds[iFace] == faceId)
+        {
+            return false;
+        }
+    }
 
     if (geomID == result->idTMQuery)
         // self intersection
@@ -253,13 +715,22 @@ bool closestPointQueryFunc(RTCPointQueryFunctionArguments* args)
     // * closer to the query position. This is optional but allows for faster
     // * traversal (due to better culling).
     // */
-    if (d < args->query->radius)
+    // the gathered candidates are ordered by (distance, faceId), thus the ones at the query radius are kept
+    bool closer = result->deferTetTraverse ? d <= args->query->radius : d < args->query->radius;
+    if (closer)
     {
         bool inFeasibleRegion = false;
 
         if (result->checkFeasibleRegion)
         {
-            inFeasibleRegion = result->pDCD->checkFeasibleRegion(queryPt, pTMSearch, primID, pointType, pDCD->params.feasibleRegionEpsilon);
+            if (pDCD->params.useFeasibleRegionTable)
+            {
+                inFeasibleRegion = pDCD->checkFeasibleRegionFromTable(queryPt, geomID, faceId, pointType);
+            }
+            else
+            {
+                inFeasibleRegion = pDCD->checkFeasibleRegion(queryPt, pTMSearch, faceId, pointType, pDCD->params.feasibleRegionEpsilon);
+            }
         }
         else
         {
@@ -268,115 +739,15 @@ bool closestPointQueryFunc(RTCPointQueryFunctionArguments* args)
         if (!inFeasibleRegion) {
             return false;
         }
+        else if (result->deferTetTraverse) {
+            return gatherClosestPointCandidate(args, result, faceId, closestP, closestPtBarycentrics, pointType, d);
+        }
         else if (result->checkTetTraverse) {
 
             if (geomID == result->idTMQuery 
                 || pDCD->params.tetrahedralTraverseForNonSelfIntersection)
             {
-                ++result->numberOfTetTraversal;
-                // query point traverse to closest point 
-                //PathFinder::CPoint rayDirection = (closestP - qq);
-                //pathFinder->markDesination(intersectionType, result->pMeshClosestElement);
-                //bool hasValidTraverse = pathFinder->rayTMeshTraverse(result->pEmbraceTet, qq, rayDirection, closestP, intersectionType, 
-                //   result->pMeshClosestElement, result->traversedTVec );
-                //pathFinder->unmarkDesination(intersectionType, result->pMeshClosestElement);
-
-                // closest point traverse to query point 
-                // we move it a little bit to the center of the triangles to avoid intersecting with edges/vertices at the first tet
-
-                Vec3fa closestPTracing;
-                if (pointType == ClosestPointOnTriangleType::AtInterior)
-                {
-                    closestPTracing = closestP ;
-                }
-                else {
-                    closestPTracing = closestP * (1.f - pDCD->params.centerShiftLevel) + (pDCD->params.centerShiftLevel / 3.0f) * (a + b + c);
-
-                }
-
-                Vec3fa targetPt;
-                if (pDCD->params.shiftQueryPointToCenter)
-                {
-                    Vec3fa tetCentroid;
-                    CuMatrix::tetCentroid(&tetCentroid.x, pTMSearch->mVertPos.data(), pTMSearch->mTetVIds.col(result->idEmbraceTet).data());
-
-                    targetPt = (1.f - pDCD->params.centerShiftLevel) * queryPt + pDCD->params.centerShiftLevel * tetCentroid;
-                }
-                else {
-                    targetPt = queryPt;
-                }
-                // traversing from the surface triangle to the query point
-                Vec3fa rayDirection = (targetPt - closestPTracing);
-                FloatingType rayLength = embree::length(rayDirection);
-                rayDirection = rayDirection / rayLength;
-                FloatingType maxSearchDis;
-            
-                if (pDCD->params.stopTraversingAfterPassingQueryPoint)
-                {
-                    maxSearchDis = pDCD->params.maxSearchDistanceMultiplier * rayLength;
-                }
-                else
-                {
-                    maxSearchDis = -1.f;
-                }
-
-                int32_t startingFaceId = pTMSearch->surfaceFacesIdAtBelongingTets(primID);
-                int32_t startingTetId = pTMSearch->surfaceFacesBelongingTets(primID);
-
-                Vec3 closestPTracingEigen;
-                closestPTracingEigen << closestPTracing.x, closestPTracing.y, closestPTracing.z;
-
-                Vec3 rayDirectionEigen;
-                rayDirectionEigen << rayDirection.x, rayDirection.y, rayDirection.z;
-
-                bool sucess = false;
-
-                TraverseStatistics traverseStatistics;
-
-    #ifdef OUTPUT_TRAVERSED_TETS 
-                std::vector<int32_t> traversedTetsOutput;
-    #endif
-                if (pDCD->params.loopLessTraverse)
-                {
-                    sucess = pTMSearch->tetrahedralTraverseToLoopLess(closestPTracingEigen, rayDirectionEigen, maxSearchDis, startingTetId,
-                        startingFaceId, result->idEmbraceTet, pDCD->params.rayTriIntersectionEPSILON, traverseStatistics);
-
-                    if(!sucess && traverseStatistics.stopReason == TraverseStopReason::emptyStack) {
-                        std::cout << "Empty stack (dead end) encountered!!! A ray is dicarded!!! \n";
-                        std::cout << "Ray source: " << closestPTracingEigen.transpose() << " | ray target: " << queryPt << "\n";
-                    }
-                }
-                else if (pDCD->params.useStaticTraverse)
-                {
-                    sucess = pTMSearch->tetrahedralTraverseTo(closestPTracingEigen, rayDirectionEigen, maxSearchDis, startingTetId,
-                        startingFaceId, result->idEmbraceTet, pDCD->params.rayTriIntersectionEPSILON, traverseStatistics);
-
-                    if (!sucess && traverseStatistics.stopReason == TraverseStopReason::emptyStack){
-                        std::cout << "Empty stack (dead end) encountered!!! A ray is dicarded!!! \n";
-                        std::cout << "Ray source: " << closestPTracingEigen.transpose() << " | ray target: " << queryPt << "\n";
-                        //std::string outName =  "F:\\Projects\\Graphics\\P05_PBDDynamics_withRotator\\traversedTets" 
-                        //    + std::to_string(startingTetId) + ".vtk";
-                        //traversedTetsOutput.pop_back();
-                        //pTMSearch->m_pTM_MF->vertPos() = pTMSearch->mVertPos.block(0,0,3, pTMSearch->numVertices());
-                        //pTMSearch->m_pTM_MF->_write_tet_list_to_vtk(outName.c_str(), traversedTetsOutput);
-                    }
-
-                    if (!sucess && traverseStatistics.stopReason == TraverseStopReason::overflow)
-                    {
-                        std::cout << "Static traverse overflow!!! \n";
-                        sucess = pTMSearch->tetrahedralTraverseToDynamic(closestPTracingEigen, rayDirectionEigen, maxSearchDis, startingTetId,
-                            startingFaceId, result->idEmbraceTet, pDCD->params.rayTriIntersectionEPSILON, traverseStatistics);
-                    }
-                }
-                else
-                {
-                    sucess = pTMSearch->tetrahedralTraverseToDynamic(closestPTracingEigen, rayDirectionEigen, maxSearchDis, startingTetId,
-                        startingFaceId, result->idEmbraceTet, pDCD->params.rayTriIntersectionEPSILON, traverseStatistics);
-                }
-
-                result->numberOfTetsTraversed += traverseStatistics.numTetsTraversed;
-
-                if (!sucess)
+                if (!tetTraverseFromClosestPoint(result, geomID, faceId, queryPt, closestP, pointType))
                 {
                     return false;
                 }
@@ -386,7 +757,7 @@ bool closestPointQueryFunc(RTCPointQueryFunctionArguments* args)
 
         args->query->radius = d;
         
-        result->closestFaceId = primID;
+        result->closestFaceId = faceId;
         result->closestPt = closestP;
         result->closestPtBarycentrics = closestPtBarycentrics;
 
@@ -399,6 +770,350 @@ bool closestPointQueryFunc(RTCPointQueryFunctionArguments* args)
     return false;
 }
 
+// true if no point of the cluster can be a feasible closest point to p, see SurfaceFaceClusterNormalCone
+inline bool normalConeExcludesPoint(const SurfaceFaceClusterNormalCone& cone, const Vec3fa& p)
+{
+    Vec3fa v = p - cone.center;
+    float dis2 = embree::dot(v, v);
+    if (dis2 <= cone.radius * cone.radius)
+    {
+        return false;
+    }
+
+    // the lines from the bounding sphere to p are within angle asin(radius / dis) of v
+    float dis = sqrtf(dis2);
+    float sinSphereAngle = cone.radius / dis;
+    float cosSphereAngle = sqrtf(1.f - sinSphereAngle * sinSphereAngle);
+    float cosMaxAngle = cone.cosHalfAngle * cosSphereAngle - cone.sinHalfAngle * sinSphereAngle;
+    if (cosMaxAngle <= 0.f)
+    {
+        return false;
+    }
+
+    return fabsf(embree::dot(v, cone.axis)) < cosMaxAngle * dis;
+}
+
+// the closest points to a query point on the faces of a surface face cluster, by the SIMD kernel closestPointTriangleN
+struct SurfaceFaceClusterClosestPoints
+{
+    typedef embree::vfloat<CLOSEST_POINT_SIMD_WIDTH> vfloatN;
+    typedef embree::vint<CLOSEST_POINT_SIMD_WIDTH> vintN;
+    typedef embree::Vec3<vfloatN> Vec3vfN;
+
+    // gathers the cluster to SoA layout, padding lanes repeat the first face
+    void loadFaces(TetMeshFEM* pTMSearch, const std::array<int32_t, SURFACE_FACE_CLUSTER_SIZE>& faceIds)
+    {
+        numFaces = 0;
+        for (int iFace = 0; iFace < SURFACE_FACE_CLUSTER_SIZE; iFace++)
+        {
+            numFaces += faceIds[iFace] != -1;
+        }
+
+        for (int iFace = 0; iFace < SURFACE_FACE_CLUSTER_SIZE; iFace++)
+        {
+            int32_t faceId = faceIds[iFace] != -1 ? faceIds[iFace] : faceIds[0];
+            for (int iV = 0; iV < 3; iV++)
+            {
+                const float* v = pTMSearch->mVertPos.col(pTMSearch->surfaceFacesTetMeshVIds(iV, faceId)).data();
+                triVerts[3 * iV][iFace] = v[0];
+                triVerts[3 * iV + 1][iFace] = v[1];
+                triVerts[3 * iV + 2][iFace] = v[2];
+            }
+        }
+    }
+
+    void computeClosestPoints(const Vec3fa& p)
+    {
+        const Vec3vfN queryPt(vfloatN(p.x), vfloatN(p.y), vfloatN(p.z));
+        for (int iLane = 0; iLane < numFaces; iLane += CLOSEST_POINT_SIMD_WIDTH)
+        {
+            const Vec3vfN a(vfloatN::load(triVerts[0] + iLane), vfloatN::load(triVerts[1] + iLane), vfloatN::load(triVerts[2] + iLane));
+            const Vec3vfN b(vfloatN::load(triVerts[3] + iLane), vfloatN::load(triVerts[4] + iLane), vfloatN::load(triVerts[5] + iLane));
+            const Vec3vfN c(vfloatN::load(triVerts[6] + iLane), vfloatN::load(triVerts[7] + iLane), vfloatN::load(triVerts[8] + iLane));
+
+            Vec3vfN baryCentricsN;
+            vintN pointTypeN;
+            vfloatN distanceN;
+            Vec3vfN closestPtN = closestPointTriangleN<CLOSEST_POINT_SIMD_WIDTH>(queryPt, a, b, c, baryCentricsN, pointTypeN, distanceN);
+
+            vfloatN::store(closestPts[0] + iLane, closestPtN.x);
+            vfloatN::store(closestPts[1] + iLane, closestPtN.y);
+            vfloatN::store(closestPts[2] + iLane, closestPtN.z);
+            vfloatN::store(baryCentrics[0] + iLane, baryCentricsN.x);
+            vfloatN::store(baryCentrics[1] + iLane, baryCentricsN.y);
+            vfloatN::store(baryCentrics[2] + iLane, baryCentricsN.z);
+            vfloatN::store(distances + iLane, distanceN);
+            vintN::store(pointTypes + iLane, pointTypeN);
+        }
+    }
+
+    Vec3fa closestPt(int iFace) const { return Vec3fa(closestPts[0][iFace], closestPts[1][iFace], closestPts[2][iFace]); }
+    Vec3fa closestPtBarycentrics(int iFace) const { return Vec3fa(baryCentrics[0][iFace], baryCentrics[1][iFace], baryCentrics[2][iFace]); }
+
+    int numFaces = 0;
+    alignas(32) float triVerts[9][SURFACE_FACE_CLUSTER_SIZE];
+    alignas(32) float closestPts[3][SURFACE_FACE_CLUSTER_SIZE];
+    alignas(32) float baryCentrics[3][SURFACE_FACE_CLUSTER_SIZE];
+    alignas(32) float distances[SURFACE_FACE_CLUSTER_SIZE];
+    alignas(32) int pointTypes[SURFACE_FACE_CLUSTER_SIZE];
+};
+
+// groupQueriesByEmbracingTet: point query function of the BVH query of a group (DiscreteCollisionDetector::closestPointQueryGroup)
+// each member validates the closest points to it on the faces of the primitive from the nearest one, against its own query
+// radius as closestPointQueryFunc; a face within the query radius of a member is within the distance of the member to the
+// centroid plus that radius from the centroid, thus the group query radius is the max of them over the members
+// pClusters: the face clusters of the leaf batched surface BVH, whose primitives are clusters, nullptr if they are faces
+// returns true if the query radius changed
+bool closestPointQueryGroupFunc(RTCPointQueryFunctionArguments* args, const SurfaceFaceClusters* pClusters)
+{
+    ClosestPointQueryResult* groupResult = (ClosestPointQueryResult*)args->userPtr;
+    ClosestPointQueryGroup* pGroup = groupResult->pGroup;
+    DiscreteCollisionDetector* pDCD = groupResult->pDCD;
+    TetMeshFEM* pTMSearch = pDCD->tMeshPtrs[args->geomID].get();
+
+    SurfaceFaceClusterClosestPoints cluster;
+    int32_t faceId = args->primID;
+    const int32_t* faceIds = &faceId;
+    int numFaces = 1;
+    const SurfaceFaceClusterNormalCone* pNormalCone = nullptr;
+    if (pClusters)
+    {
+        faceIds = pClusters->faceIds[args->primID].data();
+        cluster.loadFaces(pTMSearch, pClusters->faceIds[args->primID]);
+        numFaces = cluster.numFaces;
+        if (pClusters->normalCones.size())
+        {
+            pNormalCone = &pClusters->normalCones[args->primID];
+        }
+    }
+
+    // counted per face evaluated, same as closestPointQueryFunc, the members share the budget of a single query
+    groupResult->numberOfBVHQuery += numFaces;
+    if (groupResult->numberOfBVHQuery > pDCD->params.maxNumberOfBVHQuery) {
+        args->query->radius = 0;
+        return true;
+    }
+
+    Vec3fa closestPts[SURFACE_FACE_CLUSTER_SIZE];
+    Vec3fa baryCentrics[SURFACE_FACE_CLUSTER_SIZE];
+    ClosestPointOnTriangleType pointTypes[SURFACE_FACE_CLUSTER_SIZE];
+    float distances[SURFACE_FACE_CLUSTER_SIZE];
+    int order[SURFACE_FACE_CLUSTER_SIZE];
+
+    RTCPointQueryFunctionArguments memberArgs = *args;
+    float groupRadius = 0.f;
+    for (size_t iMember = 0; iMember < pGroup->queries.size(); iMember++)
+    {
+        RTCPointQuery& query = pGroup->queries[iMember];
+        ClosestPointQueryResult* result = &pGroup->closestPtResults[iMember];
+        Vec3fa queryPt(query.x, query.y, query.z);
+
+        // the normal cone is checked against each member instead of the centroid
+        if (!pNormalCone || !result->checkFeasibleRegion || !normalConeExcludesPoint(*pNormalCone, queryPt))
+        {
+            // the same kernels as closestPointQueryFunc and closestPointQueryLeafBatchedFunc
+            if (pClusters)
+            {
+                cluster.computeClosestPoints(queryPt);
+            }
+            for (int iFace = 0; iFace < numFaces; iFace++)
+            {
+                if (pClusters)
+                {
+                    closestPts[iFace] = cluster.closestPt(iFace);
+                    baryCentrics[iFace] = cluster.closestPtBarycentrics(iFace);
+                    pointTypes[iFace] = (ClosestPointOnTriangleType)cluster.pointTypes[iFace];
+                    distances[iFace] = cluster.distances[iFace];
+                }
+                else
+                {
+                    int32_t* faceVIds = pTMSearch->surfaceFacesTetMeshVIds.col(faceIds[iFace]).data();
+                    closestPts[iFace] = SP::closestPointTriangle(queryPt, loadVertexPos(pTMSearch, faceVIds[0]),
+                        loadVertexPos(pTMSearch, faceVIds[1]), loadVertexPos(pTMSearch, faceVIds[2]), baryCentrics[iFace],
+                        pointTypes[iFace]);
+                    distances[iFace] = embree::distance(queryPt, closestPts[iFace]);
+                }
+
+                int iInsert = iFace;
+                while (iInsert > 0 && distances[order[iInsert - 1]] > distances[iFace])
+                {
+                    order[iInsert] = order[iInsert - 1];
+                    --iInsert;
+                }
+                order[iInsert] = iFace;
+            }
+
+            memberArgs.query = &query;
+            memberArgs.userPtr = (void*)result;
+            for (int iCandidate = 0; iCandidate < numFaces; iCandidate++)
+            {
+                int iFace = order[iCandidate];
+                // the remaining candidates are not closer than this one
+                if (validateClosestPointCandidate(&memberArgs, result, faceIds[iFace], closestPts[iFace], baryCentrics[iFace],
+                    pointTypes[iFace], distances[iFace]))
+                {
+                    break;
+                }
+            }
+        }
+
+        groupRadius = std::max(groupRadius, pGroup->centroidDistances[iMember] + query.radius);
+    }
+
+    if (groupRadius < args->query->radius)
+    {
+        args->query->radius = groupRadius;
+        return true;
+    }
+    return false;
+}
+
+bool closestPointQueryFunc(RTCPointQueryFunctionArguments* args)
+{
+    ClosestPointQueryResult* result = (ClosestPointQueryResult*)args->userPtr;
+    if (result->pGroup)
+    {
+        return closestPointQueryGroupFunc(args, nullptr);
+    }
+    // TetMeshFEM* pTMQuery = result->pDCD->tMeshPtrs[result->idTMQuery].get();
+    ++result->numberOfBVHQuery;
+    if (result->numberOfBVHQuery > result->pDCD->params.maxNumberOfBVHQuery) {
+        result->found = false;
+        args->query->radius = 0;
+        return true;
+    }
+
+    assert(args->userPtr);
+    const unsigned int geomID = args->geomID;
+    const unsigned int primID = args->primID;
+    TetMeshFEM* pTMSearch = result->pDCD->tMeshPtrs[geomID].get();
+
+    embree::Vec3fa queryPt(args->query->x, args->query->y, args->query->z);
+    //PathFinder::CPoint qq =
+    /*
+     * Get triangle information in local space
+     */
+
+    embree::Vec3ia face(pTMSearch->surfaceFacesTetMeshVIds(0, primID), pTMSearch->surfaceFacesTetMeshVIds(1, primID), pTMSearch->surfaceFacesTetMeshVIds(2, primID));
+
+    embree::Vec3fa a = loadVertexPos(pTMSearch, face[0]);
+    embree::Vec3fa b = loadVertexPos(pTMSearch, face[1]);
+    embree::Vec3fa c = loadVertexPos(pTMSearch, face[2]);
+
+    ///*
+    // * Determine distance to closest point on triangle (implemented in
+    // * common/math/closest_point.h), and transform in world space if necessary.
+    // */
+    ClosestPointOnTriangleType pointType;
+    Vec3fa closestPtBarycentrics;
+    Vec3fa closestP = SP::closestPointTriangle(queryPt, a, b, c, closestPtBarycentrics, pointType);
+    float d = embree::distance(queryPt, closestP);
+    // printf_s("Queried triangle with distance: %f\n", d);
+
+    return validateClosestPointCandidate(args, result, primID, closestP, closestPtBarycentrics, pointType, d);
+}
+
+void surfaceFaceClusterBoundsFunc(const RTCBoundsFunctionArguments* args)
+{
+    const SurfaceFaceClusters* pClusters = (const SurfaceFaceClusters*)args->geometryUserPtr;
+    TetMeshFEM* pTM = pClusters->pTM;
+    const std::array<int32_t, SURFACE_FACE_CLUSTER_SIZE>& faceIds = pClusters->faceIds[args->primID];
+
+    embree::BBox3fa bounds(embree::empty);
+    for (int iFace = 0; iFace < SURFACE_FACE_CLUSTER_SIZE && faceIds[iFace] != -1; iFace++)
+    {
+        for (int iV = 0; iV < 3; iV++)
+        {
+            bounds.extend(loadVertexPos(pTM, pTM->surfaceFacesTetMeshVIds(iV, faceIds[iFace])));
+        }
+    }
+
+    RTCBounds* bounds_o = args->bounds_o;
+    bounds_o->lower_x = bounds.lower.x;
+    bounds_o->lower_y = bounds.lower.y;
+    bounds_o->lower_z = bounds.lower.z;
+    bounds_o->upper_x = bounds.upper.x;
+    bounds_o->upper_y = bounds.upper.y;
+    bounds_o->upper_z = bounds.upper.z;
+}
+
+// point query function of the leaf batched surface BVH, primID is a face cluster
+// the closest points to all the faces of the cluster are computed by the SIMD kernel, then the candidates closer than
+// the query radius are validated from the nearest to the farthest, as in the per face version only the first valid one can
+// shrink the query radius
+bool closestPointQueryLeafBatchedFunc(RTCPointQueryFunctionArguments* args)
+{
+    ClosestPointQueryResult* result = (ClosestPointQueryResult*)args->userPtr;
+    assert(args->userPtr);
+    const unsigned int geomID = args->geomID;
+    const SurfaceFaceClusters& clusters = result->pDCD->surfaceFaceClusters[geomID];
+
+    if (result->pGroup)
+    {
+        return closestPointQueryGroupFunc(args, &clusters);
+    }
+
+    if (clusters.normalCones.size() && result->checkFeasibleRegion
+        && normalConeExcludesPoint(clusters.normalCones[args->primID], Vec3fa(args->query->x, args->query->y, args->query->z)))
+    {
+        return false;
+    }
+
+    const std::array<int32_t, SURFACE_FACE_CLUSTER_SIZE>& faceIds = clusters.faceIds[args->primID];
+    TetMeshFEM* pTMSearch = result->pDCD->tMeshPtrs[geomID].get();
+    SurfaceFaceClusterClosestPoints cluster;
+    cluster.loadFaces(pTMSearch, faceIds);
+    const int numFaces = cluster.numFaces;
+
+    // counted per face evaluated, same as closestPointQueryFunc
+    result->numberOfBVHQuery += numFaces;
+    if (result->numberOfBVHQuery > result->pDCD->params.maxNumberOfBVHQuery) {
+        result->found = false;
+        args->query->radius = 0;
+        return true;
+    }
+
+    cluster.computeClosestPoints(Vec3fa(args->query->x, args->query->y, args->query->z));
+    const float* distances = cluster.distances;
+
+    // order the faces by distance, insertion sort is enough for a single cluster
+    int order[SURFACE_FACE_CLUSTER_SIZE];
+    int numCandidates = 0;
+    for (int iFace = 0; iFace < numFaces; iFace++)
+    {
+        if (result->deferTetTraverse ? distances[iFace] > args->query->radius : distances[iFace] >= args->query->radius)
+        {
+            continue;
+        }
+        int iInsert = numCandidates++;
+        while (iInsert > 0 && distances[order[iInsert - 1]] > distances[iFace])
+        {
+            order[iInsert] = order[iInsert - 1];
+            --iInsert;
+        }
+        order[iInsert] = iFace;
+    }
+
+    bool radiusChanged = false;
+    for (int iCandidate = 0; iCandidate < numCandidates; iCandidate++)
+    {
+        int iFace = order[iCandidate];
+        if (validateClosestPointCandidate(args, result, faceIds[iFace], cluster.closestPt(iFace), cluster.closestPtBarycentrics(iFace),
+            (ClosestPointOnTriangleType)cluster.pointTypes[iFace], distances[iFace]))
+        {
+            // the remaining candidates of the cluster are not closer than this one
+            // a gathered candidate only bounds the radius, the remaining ones may still enter the heap
+            if (!result->deferTetTraverse)
+            {
+                return true;
+            }
+            radiusChanged = true;
+        }
+    }
+
+    return radiusChanged;
+}
+
 bool restPoseClosestPointQueryFunc(RTCPointQueryFunctionArguments* args)
 {
 #ifndef ENABLE_REST_POSE_CLOSEST_POINT
@@ -423,9 +1138,9 @@ bool restPoseClosestPointQueryFunc(RTCPointQueryFunctionArguments* args)
     embree::Vec3ia face(pTMSearch->surfaceFacesTetMeshVIds(0, primID), 
         pTMSearch->surfaceFacesTetMeshVIds(1, primID), pTMSearch->surfaceFacesTetMeshVIds(2, primID));
 
-    embree::Vec3fa a = embree::Vec3fa::loadu(pTMSearch->restposeVerts.col(face[0]).data());
-    embree::Vec3fa b = embree::Vec3fa::loadu(pTMSearch->restposeVerts.col(face[1]).data());
-    embree::Vec3fa c = embree::Vec3fa::loadu(pTMSearch->restposeVerts.col(face[2]).data());
+    embree::Vec3fa a = loadRestposeVertexPos(pTMSearch, face[0]);
+    embree::Vec3fa b = loadRestposeVertexPos(pTMSearch, face[1]);
+    embree::Vec3fa c = loadRestposeVertexPos(pTMSearch, face[2]);
 
     ClosestPointOnTriangleType pointType;
     Vec3fa closestPtBarycentrics;
@@ -439,9 +1154,9 @@ bool restPoseClosestPointQueryFunc(RTCPointQueryFunctionArguments* args)
 
         result->closestFaceId = primID;
         // compute back to deformed configuration
-        embree::Vec3fa aD = embree::Vec3fa::loadu(pTMSearch->mVertPos.col(face[0]).data());
-        embree::Vec3fa bD = embree::Vec3fa::loadu(pTMSearch->mVertPos.col(face[1]).data());
-        embree::Vec3fa cD = embree::Vec3fa::loadu(pTMSearch->mVertPos.col(face[2]).data());
+        embree::Vec3fa aD = loadVertexPos(pTMSearch, face[0]);
+        embree::Vec3fa bD = loadVertexPos(pTMSearch, face[1]);
+        embree::Vec3fa cD = loadVertexPos(pTMSearch, face[2]);
         result->closestPt = aD * closestPtBarycentrics[0]
             + bD * closestPtBarycentrics[1]
             + cD * closestPtBarycentrics[2];
@@ -459,6 +1174,24 @@ bool restPoseClosestPointQueryFunc(RTCPointQueryFunctionArguments* args)
 }
 
 
+// shares the vertex positions of the mesh with the Embree geometry: the aligned storage (stride 16) if enabled,
+// otherwise the Eigen matrix (stride 12), padded with an extra vertex since Embree loads 16 bytes per vertex
+void setSharedVertexBuffer(RTCGeometry geom, TetMeshFEM* pTM, bool restpose)
+{
+    if (pTM->alignedVertexStorageEnabled)
+    {
+        void* pVerts = restpose ? pTM->alignedRestposeVerts.data() : pTM->alignedVertPos.data();
+        rtcSetSharedGeometryBuffer(geom,
+            RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, pVerts, 0, sizeof(embree::Vec3fa), pTM->numVertices());
+    }
+    else
+    {
+        void* pVerts = restpose ? pTM->restposeVerts.data() : pTM->mVertPos.data();
+        rtcSetSharedGeometryBuffer(geom,
+            RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, pVerts, 0, 3 * sizeof(float), pTM->numVertices());
+    }
+}
+
 SP::DiscreteCollisionDetector::DiscreteCollisionDetector(const CollisionDetectionParamters& in_params)
 	: params(in_params)
 {
@@ -473,27 +1206,63 @@ void SP::DiscreteCollisionDetector::initialize(std::vector<std::shared_ptr<TetMe
 
 	numTetsTotal = 0;
 
+    for (int meshId = 0; meshId < tMeshes.size(); meshId++)
+    {
+        // before the geometries are created, they may share the aligned buffers
+        tMeshes[meshId]->alignedVertexStorageEnabled = params.alignedVertexStorage;
+        if (tMeshes[meshId]->alignedVertexStorageEnabled)
+        {
+            tMeshes[meshId]->updateAlignedVertexStorage();
+#ifdef ENABLE_REST_POSE_CLOSEST_POINT
+            tMeshes[meshId]->updateAlignedRestposeStorage();
+#endif // ENABLE_REST_POSE_CLOSEST_POINT
+        }
+    }
+
+    if (params.leafBatchedClosestPoint && !params.restPoseCloestPoint)
+    {
+        // allocated at once, the geometries keep pointers to its elements
+        surfaceFaceClusters.resize(tMeshes.size());
+    }
+
 	// construct a separate scene for each surface mesh for shortest path query
 	for (int meshId = 0; meshId < tMeshes.size(); meshId++)
 	{
 		RTCScene scene = rtcNewScene(device);
-		RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
 
         rtcSetSceneFlags(scene, RTC_SCENE_FLAG_DYNAMIC | RTC_SCENE_FLAG_ROBUST);
         rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_LOW);
 
+        if (surfaceFaceClusters.size())
+        {
+            SurfaceFaceClusters& clusters = surfaceFaceClusters[meshId];
+            buildSurfaceFaceClusters(meshId, clusters);
+
+            RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+            rtcSetGeometryUserPrimitiveCount(geom, clusters.faceIds.size());
+            rtcSetGeometryUserData(geom, (void*)&clusters);
+            rtcSetGeometryBoundsFunction(geom, surfaceFaceClusterBoundsFunc, nullptr);
+            rtcSetGeometryPointQueryFunction(geom, closestPointQueryLeafBatchedFunc);
+
+            rtcCommitGeometry(geom);
+            rtcAttachGeometryByID(scene, geom, meshId);
+            rtcReleaseGeometry(geom);
+            rtcCommitScene(scene);
+
+            surfaceMeshScenes.push_back(scene);
+            continue;
+        }
+
+		RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+
         // use the existing buffer as Embree buffer
         if (params.restPoseCloestPoint)
         {
-            rtcSetSharedGeometryBuffer(geom,
-                RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, tMeshes[meshId]->restposeVerts.data(), 0, 3 * sizeof(float), 
-                tMeshes[meshId]->numVertices());
+            setSharedVertexBuffer(geom, tMeshes[meshId].get(), true);
             rtcSetGeometryPointQueryFunction(geom, restPoseClosestPointQueryFunc);
         }
         else {
-            rtcSetSharedGeometryBuffer(geom,
-                RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, tMeshes[meshId]->mVertPos.data(), 0, 3 * sizeof(float),
-                tMeshes[meshId]->numVertices());
+            setSharedVertexBuffer(geom, tMeshes[meshId].get(), false);
             rtcSetGeometryPointQueryFunction(geom, closestPointQueryFunc);
         }
     
@@ -515,13 +1284,74 @@ void SP::DiscreteCollisionDetector::initialize(std::vector<std::shared_ptr<TetMe
 	// add all the tet mesh to a single scene for collision detection
 	for (int meshId = 0; meshId < tMeshes.size(); meshId++)
 	{
-		RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_QUAD);
+        tMeshes[meshId]->packedTetTopologyEnabled = params.packedTetTopology;
+        tMeshes[meshId]->simdExitFaceKernelEnabled = params.simdExitFaceKernel;
+        tMeshes[meshId]->pluckerTraverseEnabled = params.pluckerTraverse;
+        tMeshes[meshId]->bestFirstBranchOrderEnabled = params.bestFirstBranchOrder;
+        tMeshes[meshId]->surfaceNormalCacheEnabled = params.cacheSurfaceNormals;
+        if (tMeshes[meshId]->surfaceNormalCacheEnabled)
+        {
+            tMeshes[meshId]->updateSurfaceNormalCache();
+        }
+
+        if (params.cacheTraversalVerdicts)
+        {
+            traversalVerdictCaches.resize(tMeshes.size());
+            traversalVerdictCaches[meshId].resize(params.traversalVerdictCacheLog2Size);
+        }
+
+        if (params.warmStartClosestPointRadius)
+        {
+            closestFaceCaches.resize(tMeshes.size());
+            closestFaceCaches[meshId] = std::vector<std::atomic<int64_t>>(tMeshes[meshId]->numVertices() * tMeshes.size());
+            for (std::atomic<int64_t>& cachedClosestFace : closestFaceCaches[meshId])
+            {
+                cachedClosestFace.store(-1, std::memory_order_relaxed);
+            }
+        }
+
+        if (params.warmStartEmbracingTets)
+        {
+            embracingTetCaches.resize(tMeshes.size());
+            embracingTetCaches[meshId].resize(tMeshes[meshId]->numVertices());
+        }
+
+        if (params.useFeasibleRegionTable)
+        {
+            // uses the surface normal cache if enabled, thus updated after it
+            feasibleRegionTables.resize(tMeshes.size());
+            updateFeasibleRegionTable(meshId);
+        }
+
+        if (params.normalConePruning && surfaceFaceClusters.size())
+        {
+            updateSurfaceFaceClusterNormalCones(meshId);
+        }
+
+        tMeshes[meshId]->tetGeometryCacheEnabled = params.cacheTetGeometry || params.useTetFacePlanePrimitive;
+        if (tMeshes[meshId]->tetGeometryCacheEnabled)
+        {
+            tMeshes[meshId]->updateTetGeometryCache();
+        }
+
+        RTCGeometry geom;
+        if (params.useTetFacePlanePrimitive)
+        {
+            geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+            rtcSetGeometryUserPrimitiveCount(geom, tMeshes[meshId]->numTets());
+            rtcSetGeometryUserData(geom, (void*)tMeshes[meshId].get());
+            rtcSetGeometryBoundsFunction(geom, tetBoundsFunc, nullptr);
+        }
+        else
+        {
+            // the 4 vertices of a tet are registered as a quad, whose bounds are the bounds of the tet
+            geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_QUAD);
 
-		rtcSetSharedGeometryBuffer(geom, 
-			RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, tMeshes[meshId]->mVertPos.data(), 0, 3 * sizeof(float), tMeshes[meshId]->numVertices());
+            setSharedVertexBuffer(geom, tMeshes[meshId].get(), false);
 
-		rtcSetSharedGeometryBuffer(geom,
-			RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, tMeshes[meshId]->mTetVIds.data(), 0, 4 * sizeof(unsigned), tMeshes[meshId]->numTets());
+            rtcSetSharedGeometryBuffer(geom,
+                RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, tMeshes[meshId]->mTetVIds.data(), 0, 4 * sizeof(unsigned), tMeshes[meshId]->numTets());
+        }
 
 		rtcSetGeometryPointQueryFunction(geom, tetIntersectionFunc);
 
@@ -561,6 +1391,12 @@ void SP::DiscreteCollisionDetector::updateBVH(RTCBuildQuality tetMeshSceneQualit
         TetMeshFEM* pTM = tMeshPtrs[iMesh].get();
         RTCGeometry geom = rtcGetGeometry(tetMeshesScene, geoId);
 
+        // also read for the query vertices, thus updated even if the mesh is not active for collision
+        if (pTM->alignedVertexStorageEnabled)
+        {
+            pTM->updateAlignedVertexStorage();
+        }
+
         if (pTM->activeForCollision) {
             rtcEnableGeometry(geom);
         }
@@ -575,7 +1411,32 @@ void SP::DiscreteCollisionDetector::updateBVH(RTCBuildQuality tetMeshSceneQualit
         //rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0);
         //rtcCommitGeometry(geom);
 
-        rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0);
+        if (pTM->tetGeometryCacheEnabled)
+        {
+            pTM->updateTetGeometryCache();
+        }
+        if (pTM->surfaceNormalCacheEnabled)
+        {
+            pTM->updateSurfaceNormalCache();
+        }
+        if (params.useFeasibleRegionTable)
+        {
+            updateFeasibleRegionTable(iMesh);
+        }
+        if (params.normalConePruning && surfaceFaceClusters.size())
+        {
+            updateSurfaceFaceClusterNormalCones(iMesh);
+        }
+        if (params.cacheTraversalVerdicts)
+        {
+            traversalVerdictCaches[iMesh].clear();
+        }
+
+        // the bounds of the user defined tet primitive are recomputed by tetBoundsFunc at commit
+        if (!params.useTetFacePlanePrimitive)
+        {
+            rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0);
+        }
         rtcCommitGeometry(geom);
      
         if (updateSurfaceScene && !params.restPoseCloestPoint) {
@@ -586,7 +1447,11 @@ void SP::DiscreteCollisionDetector::updateBVH(RTCBuildQuality tetMeshSceneQualit
             RTCGeometry geomSurface = rtcGetGeometry(surfaceScene, iMesh);
             rtcSetGeometryBuildQuality(geomSurface, surfaceGeomQuality);
 
-            rtcUpdateGeometryBuffer(geomSurface, RTC_BUFFER_TYPE_VERTEX, 0);
+            if (!surfaceFaceClusters.size())
+            {
+                rtcUpdateGeometryBuffer(geomSurface, RTC_BUFFER_TYPE_VERTEX, 0);
+            }
+            // the cluster bounds are recomputed from the current vertex positions by the bounds function at commit
             rtcCommitGeometry(geomSurface);
             rtcCommitScene(surfaceScene);
         }
@@ -595,105 +1460,349 @@ void SP::DiscreteCollisionDetector::updateBVH(RTCBuildQuality tetMeshSceneQualit
     rtcCommitScene(tetMeshesScene);
 }
 
-bool SP::DiscreteCollisionDetector::vertexCollisionDetection(int32_t vId, int32_t tMeshId, CollisionDetectionResult* pResult)
+void SP::DiscreteCollisionDetector::buildSurfaceFaceClusters(int32_t meshId, SurfaceFaceClusters& clusters)
 {
-    RTCPointQueryContext context;
-    rtcInitPointQueryContext(&context);
-    TetMeshFEM* pTM = tMeshPtrs[tMeshId].get();
-    RTCPointQuery query;
-    query.x = pTM->mVertPos(0, vId);
-    query.y = pTM->mVertPos(1, vId);
-    query.z = pTM->mVertPos(2, vId);
-    query.radius = 0.f;
-    query.time = 0.f;
+    TetMeshFEM* pTM = tMeshPtrs[meshId].get();
+    clusters.pTM = pTM;
+    clusters.faceIds.clear();
 
-    pResult->clear();
+    std::vector<bool> faceClustered(pTM->numSurfaceFaces(), false);
+    std::vector<int32_t> faceQueue;
+    for (int32_t seedFaceId = 0; seedFaceId < pTM->numSurfaceFaces(); seedFaceId++)
+    {
+        if (faceClustered[seedFaceId])
+        {
+            continue;
+        }
 
-    pResult->idTMQuery = tMeshId;
-    pResult->idVQuery = vId;
-    pResult->pDetector = (void*)this;
-    pResult->handleSelfIntersection = params.handleSelfCollision;
+        std::array<int32_t, SURFACE_FACE_CLUSTER_SIZE> cluster;
+        cluster.fill(-1);
+        int numFaces = 0;
 
-    rtcPointQuery(tetMeshesScene, &query, &context, nullptr, (void*)pResult);
-    return true;
-}
+        faceQueue.clear();
+        faceQueue.push_back(seedFaceId);
+        faceClustered[seedFaceId] = true;
+        for (size_t iQueue = 0; iQueue < faceQueue.size() && numFaces < SURFACE_FACE_CLUSTER_SIZE; iQueue++)
+        {
+            int32_t faceId = faceQueue[iQueue];
+            cluster[numFaces++] = faceId;
 
-bool SP::DiscreteCollisionDetector::closestPointQuery(CollisionDetectionResult* pColResult, ClosestPointQueryResult* pClosestPtResult, bool computeClosestPointNormal)
-{
-    TetMeshFEM* pTM = tMeshPtrs[pColResult->idTMQuery].get();
-    RTCPointQuery query;
+            for (int iNei = 0; iNei < 3; iNei++)
+            {
+                int32_t neiFaceId = pTM->surfaceFaces3NeighborFaces(iNei, faceId);
+                if (neiFaceId != -1 && !faceClustered[neiFaceId]
+                    && numFaces + faceQueue.size() - iQueue - 1 < SURFACE_FACE_CLUSTER_SIZE)
+                {
+                    faceClustered[neiFaceId] = true;
+                    faceQueue.push_back(neiFaceId);
+                }
+            }
+        }
+        clusters.faceIds.push_back(cluster);
+    }
+}
 
+void SP::DiscreteCollisionDetector::updateSurfaceFaceClusterNormalCones(int32_t meshId)
+{
+    SurfaceFaceClusters& clusters = surfaceFaceClusters[meshId];
+    TetMeshFEM* pTM = clusters.pTM;
+    const float feasibleRegionEpsilon = params.feasibleRegionEpsilon;
+    clusters.normalCones.resize(clusters.faceIds.size());
+
+    // the feasible directions p - x of each element are a convex cone: +-normal for a face, the wedge between the normals of
+    // the 2 neighbor faces for an edge and the polar cone of the one-ring edges for a vertex
+    // the cluster cone is a double cone around the axis containing all of them, each element must fit in a single nappe
+    auto computeNormalCone = [&](int32_t iCluster) {
+        const std::array<int32_t, SURFACE_FACE_CLUSTER_SIZE>& faceIds = clusters.faceIds[iCluster];
+        SurfaceFaceClusterNormalCone& cone = clusters.normalCones[iCluster];
+        cone.cosHalfAngle = 0.f;
+        cone.sinHalfAngle = 1.f;
+
+        embree::BBox3fa bounds(embree::empty);
+        Vec3fa firstNormal = faceNormal(pTM, faceIds[0]);
+        Vec3fa axis(0.f);
+        int numFaces = 0;
+        for (; numFaces < SURFACE_FACE_CLUSTER_SIZE && faceIds[numFaces] != -1; numFaces++)
+        {
+            Vec3fa normal = faceNormal(pTM, faceIds[numFaces]);
+            axis += embree::dot(normal, firstNormal) >= 0.f ? normal : -normal;
+            for (int iV = 0; iV < 3; iV++)
+            {
+                bounds.extend(loadVertexPos(pTM, pTM->surfaceFacesTetMeshVIds(iV, faceIds[numFaces])));
+            }
+        }
+        cone.center = embree::center(bounds);
+        cone.radius = 0.5f * embree::length(bounds.size());
 
-    query.x = pTM->mVertPos(0, pColResult->idVQuery);
-    query.y = pTM->mVertPos(1, pColResult->idVQuery);
-    query.z = pTM->mVertPos(2, pColResult->idVQuery);
+        if (embree::sqr_length(axis) < 1e-12f)
+        {
+            return;
+        }
+        axis = embree::normalize(axis);
 
-    pClosestPtResult->pDCD = this;
-    pClosestPtResult->idVQuery = pColResult->idVQuery;
-    pClosestPtResult->idTMQuery = pColResult->idTMQuery;
+        float cosHalfAngle = 1.f;
+        // the relaxation of the feasible regions (see checkEdgeFeasibleRegion) moves their apexes by at most maxRelaxation
+        float maxRelaxation = 0.f;
+        auto addEdgeRelaxation = [&](const Vec3fa& edge) {
+            float edgeLength = embree::length(edge);
+            maxRelaxation = std::max(maxRelaxation, edgeLength * feasibleRegionEpsilon + ABSOLUTE_RELAXIATION / edgeLength);
+        };
 
-    pClosestPtResult->checkFeasibleRegion = params.checkFeasibleRegion;
-    pClosestPtResult->checkTetTraverse = params.checkTetTraverse;
+        for (int iFace = 0; iFace < numFaces; iFace++)
+        {
+            int32_t faceId = faceIds[iFace];
+            int32_t* faceVIds = pTM->surfaceFacesTetMeshVIds.col(faceId).data();
+            Vec3fa normal = faceNormal(pTM, faceId);
+            cosHalfAngle = std::min(cosHalfAngle, fabsf(embree::dot(normal, axis)));
 
-    for (int  iIntersection = 0;  iIntersection < pColResult->intersectedTets.size();  iIntersection++)
+            for (int32_t edgeId = 0; edgeId < 3; edgeId++)
+            {
+                int32_t neighborFaceId = pTM->surfaceFaces3NeighborFaces(edgeId, faceId);
+                if (neighborFaceId == -1)
+                {
+                    // boundary edges are not filtered
+                    return;
+                }
+                Vec3fa neighborNormal = faceNormal(pTM, neighborFaceId);
+                float side1 = embree::dot(normal, axis);
+                float side2 = embree::dot(neighborNormal, axis);
+                if (side1 * side2 <= 0.f)
+                {
+                    return;
+                }
+                cosHalfAngle = std::min(cosHalfAngle, fabsf(side2));
+                addEdgeRelaxation(loadVertexPos(pTM, faceVIds[(edgeId + 1) % 3]) - loadVertexPos(pTM, faceVIds[edgeId]));
+            }
+
+            for (int iV = 0; iV < 3; iV++)
+            {
+                // the extreme rays of the polar cone {d | dot(d, B - A) <= 0} are the intersections of 2 of its facets
+                Vec3fa A = loadVertexPos(pTM, faceVIds[iV]);
+                const std::vector<IdType>& neighborVIds =
+                    pTM->surfaceVertexNeighborSurfaceVertices[pTM->tetVertIndicesToSurfaceVertIndices(faceVIds[iV])];
+
+                Vec3fa firstRay(0.f);
+                float firstRaySide = 0.f;
+                for (int iVNei = 0; iVNei < neighborVIds.size(); ++iVNei)
+                {
+                    Vec3fa AB = loadVertexPos(pTM, neighborVIds[iVNei]) - A;
+                    addEdgeRelaxation(AB);
+                    for (int jVNei = iVNei + 1; jVNei < neighborVIds.size(); ++jVNei)
+                    {
+                        Vec3fa AC = loadVertexPos(pTM, neighborVIds[jVNei]) - A;
+                        Vec3fa ray = embree::cross(AB, AC);
+                        float rayLength = embree::length(ray);
+                        if (rayLength < 1e-12f)
+                        {
+                            continue;
+                        }
+                        ray = ray / rayLength;
+
+                        for (float sign : {1.f, -1.f})
+                        {
+                            bool extreme = true;
+                            for (int kVNei = 0; kVNei < neighborVIds.size() && extreme; ++kVNei)
+                            {
+                                Vec3fa AD = loadVertexPos(pTM, neighborVIds[kVNei]) - A;
+                                extreme = sign * embree::dot(ray, AD) <= 1e-6f * embree::length(AD);
+                            }
+                            if (!extreme)
+                            {
+                                continue;
+                            }
+
+                            float side = sign * embree::dot(ray, axis);
+                            cosHalfAngle = std::min(cosHalfAngle, fabsf(side));
+                            if (firstRaySide == 0.f)
+                            {
+                                firstRay = sign * ray;
+                                firstRaySide = side;
+                            }
+                            // a polar cone containing opposite rays is a line (flat vertex), which fits the double cone
+                            else if (side * firstRaySide <= 0.f && embree::dot(sign * ray, firstRay) > -1.f + 1e-4f)
+                            {
+                                return;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        cone.axis = axis;
+        cone.cosHalfAngle = cosHalfAngle;
+        cone.sinHalfAngle = sqrtf(std::max(0.f, 1.f - cosHalfAngle * cosHalfAngle));
+        cone.radius += 2.f * maxRelaxation;
+    };
+    cpu_parallel_for(0, (int)clusters.faceIds.size(), computeNormalCone);
+}
+
+bool SP::DiscreteCollisionDetector::vertexCollisionDetection(int32_t vId, int32_t tMeshId, CollisionDetectionResult* pResult)
+{
+    vertexCollisionDetectionReordered(tMeshPtrs[tMeshId]->reorderedVertexId(vId), tMeshId, pResult);
+
+    // back to the original ids
+    pResult->idVQuery = vId;
+    for (int iIntersection = 0; iIntersection < pResult->numIntersections(); iIntersection++)
     {
-        query.radius = embree::inf;
-        query.time = 0.f;
+        TetMeshFEM* pTMIntersected = tMeshPtrs[pResult->intersectedTMeshIds[iIntersection]].get();
+        pResult->intersectedTets[iIntersection] = pTMIntersected->originalTetId(pResult->intersectedTets[iIntersection]);
+    }
+    return true;
+}
 
-        int idTMIntersected = pColResult->intersectedTMeshIds[iIntersection];
-        int idTetIntersected = pColResult->intersectedTets[iIntersection];
+bool SP::DiscreteCollisionDetector::vertexCollisionDetectionReordered(int32_t vId, int32_t tMeshId, CollisionDetectionResult* pResult)
+{
+    RTCPointQueryContext context;
+    rtcInitPointQueryContext(&context);
+    TetMeshFEM* pTM = tMeshPtrs[tMeshId].get();
+    RTCPointQuery query;
+    query.x = pTM->mVertPos(0, vId);
+    query.y = pTM->mVertPos(1, vId);
+    query.z = pTM->mVertPos(2, vId);
+    query.radius = 0.f;
+    query.time = 0.f;
 
-        if (params.restPoseCloestPoint)
+    pResult->clear();
+
+    pResult->idTMQuery = tMeshId;
+    pResult->idVQuery = vId;
+    pResult->pDetector = (void*)this;
+    pResult->handleSelfIntersection = params.handleSelfCollision;
+
+    if (params.warmStartEmbracingTets && warmStartVertexCollisionDetection(vId, tMeshId, pResult))
+    {
+        return true;
+    }
+
+    rtcPointQuery(tetMeshesScene, &query, &context, nullptr, (void*)pResult);
+
+    if (params.warmStartEmbracingTets)
+    {
+        EmbracingTetCache& cache = embracingTetCaches[tMeshId][vId];
+        cache.numWarmStarts = 0;
+        if (pResult->intersectedTets.size() > WARM_START_MAX_EMBRACING_TETS)
+        {
+            cache.numTets = -1;
+        }
+        else
+        {
+            cache.numTets = pResult->intersectedTets.size();
+            for (int32_t iTet = 0; iTet < cache.numTets; iTet++)
+            {
+                cache.meshIds[iTet] = pResult->intersectedTMeshIds[iTet];
+                cache.tetIds[iTet] = pResult->intersectedTets[iTet];
+            }
+        }
+    }
+    return true;
+}
+
+bool SP::DiscreteCollisionDetector::warmStartVertexCollisionDetection(int32_t vId, int32_t tMeshId, CollisionDetectionResult* pResult)
+{
+    EmbracingTetCache& cache = embracingTetCaches[tMeshId][vId];
+    // vertices not embraced at the last step still need the BVH query, as their new embracing tets can be anywhere
+    // the walks can not find the tets newly embracing the vertex, thus the BVH query is also forced every
+    // warmStartRefreshInterval steps
+    if (cache.numTets <= 0 || cache.numWarmStarts >= params.warmStartRefreshInterval)
+    {
+        return false;
+    }
+
+    const FloatingType* p = tMeshPtrs[tMeshId]->mVertPos.col(vId).data();
+    std::array<int32_t, WARM_START_MAX_EMBRACING_TETS> tetIds;
+    for (int32_t iTet = 0; iTet < cache.numTets; iTet++)
+    {
+        int32_t meshId = cache.meshIds[iTet];
+        TetMeshFEM* pTMIntersected = tMeshPtrs[meshId].get();
+        if (!pTMIntersected->activeForCollision)
         {
-            TetMeshFEM* pTMSearch = tMeshPtrs[idTMIntersected].get();
+            return false;
+        }
+
+        tetIds[iTet] = walkToEmbracingTet(p, meshId, cache.tetIds[iTet]);
+        if (tetIds[iTet] == -1)
+        {
+            return false;
+        }
 
-            // compute the barycenters in the embracing tet
-            float barycentricsEmbracingTet[4];
-            CuMatrix::tetPointBarycentricsInTet(pTM->mVertPos.col(pColResult->idVQuery).data(), pTMSearch->mVertPos.data(),
-                pTMSearch->mTetVIds.col(idTetIntersected).data(), barycentricsEmbracingTet);
-            // map back to rest pose position
-            embree::Vec3fa queryPt(0.f, 0.f, 0.f);
-            for (size_t iV = 0; iV < 4; iV++)
+        // the same exclusion as tetIntersectionFunc: the vertex has left the other side of its own surface
+        if (meshId == tMeshId)
+        {
+            for (int iV = 0; iV < 4; iV++)
             {
-                int32_t vId = pTMSearch->mTetVIds(iV, idTetIntersected);
-                embree::Vec3fa restposeP = embree::Vec3fa::loadu(pTMSearch->restposeVerts.col(vId).data());
-                queryPt += restposeP * barycentricsEmbracingTet[iV];
+                if (pTMIntersected->mTetVIds(iV, tetIds[iTet]) == vId) {
+                    return false;
+                }
+            }
+        }
 
+        // 2 walks ending in the same tet means one of the embracing regions has been left
+        for (int32_t jTet = 0; jTet < iTet; jTet++)
+        {
+            if (cache.meshIds[jTet] == meshId && tetIds[jTet] == tetIds[iTet])
+            {
+                return false;
             }
-            query.x = queryPt.x;
-            query.y = queryPt.y;
-            query.z = queryPt.z;
         }
+    }
 
-        pClosestPtResult->idEmbraceTet = idTetIntersected;
+    for (int32_t iTet = 0; iTet < cache.numTets; iTet++)
+    {
+        cache.tetIds[iTet] = tetIds[iTet];
+        pResult->intersectedTets.push_back(tetIds[iTet]);
+        pResult->intersectedTMeshIds.push_back(cache.meshIds[iTet]);
+    }
+    ++cache.numWarmStarts;
+    return true;
+}
 
-        pClosestPtResult->found = false;;
-        pClosestPtResult->closestPointType = ClosestPointOnTriangleType::NotFound;
+int32_t SP::DiscreteCollisionDetector::walkToEmbracingTet(const FloatingType* p, int32_t tMeshId, int32_t startTetId)
+{
+    TetMeshFEM* pTM = tMeshPtrs[tMeshId].get();
+    int32_t tetId = startTetId;
+    for (int32_t iStep = 0; iStep < params.warmStartWalkBudget; iStep++)
+    {
+        if (pointInTet(pTM, p, tetId))
+        {
+            return tetId;
+        }
 
-        RTCPointQueryContext context;
-        rtcInitPointQueryContext(&context);
-        rtcPointQuery(surfaceMeshScenes[idTMIntersected], &query, &context, nullptr, (void*)pClosestPtResult);
+        FloatingType barycentrics[4];
+        pTM->tetPointBarycentrics(p, tetId, barycentrics);
+        int32_t exitFaceId = 0;
+        for (int32_t iF = 1; iF < 4; iF++)
+        {
+            if (barycentrics[iF] < barycentrics[exitFaceId])
+            {
+                exitFaceId = iF;
+            }
+        }
 
-        // for testing
-        //queryPoint(closestPtResult, p, pTetIntersected, surfaceSceneId, inf);
-        //CPoint closestP1 = closestPtResult.closestP;
-        //queryPoint(closestPtResult, p, pTetIntersected, surfaceSceneId, inf, false, false);
-        //CPoint closestP2 = closestPtResult.closestP;
+        // face i of the tet is opposite to its vertex i
+        tetId = pTM->tetsNeighborTets(exitFaceId, tetId);
+        if (tetId == -1)
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
 
-        //assert((closestP2 - closestP1).norm() < 1e-6);
+bool SP::DiscreteCollisionDetector::closestPointQuery(CollisionDetectionResult* pColResult, ClosestPointQueryResult* pClosestPtResult, bool computeClosestPointNormal)
+{
+    for (int  iIntersection = 0;  iIntersection < pColResult->intersectedTets.size();  iIntersection++)
+    {
+        int idTMIntersected = pColResult->intersectedTMeshIds[iIntersection];
+        int idTetIntersected = pColResult->intersectedTets[iIntersection];
+
+        // maxNumberOfBVHQuery is the budget of each intersection, as in the batch queries
+        pClosestPtResult->numberOfBVHQuery = 0;
+        pClosestPtResult->numberOfTetTraversal = 0;
+        pClosestPtResult->numberOfTetsTraversed = 0;
+        closestPointQuery(pColResult->idVQuery, pColResult->idTMQuery, idTMIntersected, idTetIntersected, pClosestPtResult);
 
         if (pClosestPtResult->found) {
-            // pColResult->closestPoints.push_back(closestPtResult.closestP);
-            //std::array<float, 3> closestPtBarycentrics = {
-            //    pClosestPtResult->closestPtBarycentrics.x,
-            //    pClosestPtResult->closestPtBarycentrics.y,
-            //    pClosestPtResult->closestPtBarycentrics.z,
-            //};
-            //std::array<float, 3> closestPt = {
-            //    pClosestPtResult->closestPt.x,
-            //    pClosestPtResult->closestPt.y,
-            //    pClosestPtResult->closestPt.z,
-            //};
             pColResult->shortestPathFound.push_back(true);
             pColResult->closestSurfacePtBarycentrics.push_back({
                 pClosestPtResult->closestPtBarycentrics.x,
@@ -739,6 +1848,923 @@ bool SP::DiscreteCollisionDetector::closestPointQuery(CollisionDetectionResult*
     return true;
 }
 
+void SP::DiscreteCollisionDetector::initClosestPointQuery(int32_t vId, int32_t tMeshId, int32_t idTMIntersected,
+    int32_t idTetIntersected, RTCPointQuery& query, ClosestPointQueryResult* pClosestPtResult)
+{
+    TetMeshFEM* pTM = tMeshPtrs[tMeshId].get();
+
+    query.x = pTM->mVertPos(0, vId);
+    query.y = pTM->mVertPos(1, vId);
+    query.z = pTM->mVertPos(2, vId);
+    query.radius = embree::inf;
+    query.time = 0.f;
+
+    pClosestPtResult->pDCD = this;
+    pClosestPtResult->idVQuery = vId;
+    pClosestPtResult->idTMQuery = tMeshId;
+
+    pClosestPtResult->checkFeasibleRegion = params.checkFeasibleRegion;
+    pClosestPtResult->checkTetTraverse = params.checkTetTraverse;
+
+    if (params.restPoseCloestPoint)
+    {
+        TetMeshFEM* pTMSearch = tMeshPtrs[idTMIntersected].get();
+
+        // compute the barycenters in the embracing tet
+        float barycentricsEmbracingTet[4];
+        pTMSearch->tetPointBarycentrics(pTM->mVertPos.col(vId).data(), idTetIntersected, barycentricsEmbracingTet);
+        // map back to rest pose position
+        embree::Vec3fa queryPt(0.f, 0.f, 0.f);
+        for (size_t iV = 0; iV < 4; iV++)
+        {
+            int32_t tetVId = pTMSearch->mTetVIds(iV, idTetIntersected);
+            embree::Vec3fa restposeP = loadRestposeVertexPos(pTMSearch, tetVId);
+            queryPt += restposeP * barycentricsEmbracingTet[iV];
+
+        }
+        query.x = queryPt.x;
+        query.y = queryPt.y;
+        query.z = queryPt.z;
+    }
+
+    pClosestPtResult->idEmbraceTet = idTetIntersected;
+
+    pClosestPtResult->found = false;;
+    pClosestPtResult->closestPointType = ClosestPointOnTriangleType::NotFound;
+}
+
+bool SP::DiscreteCollisionDetector::closestPointQuery(int32_t vId, int32_t tMeshId, int32_t idTMIntersected, int32_t idTetIntersected,
+    ClosestPointQueryResult* pClosestPtResult, int32_t hintFaceId)
+{
+    TetMeshFEM* pTMSearch = tMeshPtrs[idTMIntersected].get();
+    closestPointQueryReordered(tMeshPtrs[tMeshId]->reorderedVertexId(vId), tMeshId, idTMIntersected,
+        pTMSearch->reorderedTetId(idTetIntersected), pClosestPtResult,
+        hintFaceId == -1 ? -1 : pTMSearch->reorderedSurfaceFaceId(hintFaceId));
+
+    // back to the original ids
+    pClosestPtResult->idVQuery = vId;
+    pClosestPtResult->idEmbraceTet = idTetIntersected;
+    if (pClosestPtResult->found)
+    {
+        pClosestPtResult->closestFaceId = pTMSearch->originalSurfaceFaceId(pClosestPtResult->closestFaceId);
+    }
+    return pClosestPtResult->found;
+}
+
+bool SP::DiscreteCollisionDetector::closestPointQueryReordered(int32_t vId, int32_t tMeshId, int32_t idTMIntersected,
+    int32_t idTetIntersected, ClosestPointQueryResult* pClosestPtResult, int32_t hintFaceId)
+{
+    RTCPointQuery query;
+    initClosestPointQuery(vId, tMeshId, idTMIntersected, idTetIntersected, query, pClosestPtResult);
+
+    if (params.lazyClosestPointValidation && !params.restPoseCloestPoint)
+    {
+        closestPointQueryLazy(query, idTMIntersected, pClosestPtResult);
+        return pClosestPtResult->found;
+    }
+
+    pClosestPtResult->numWarmStartRejectedFaces = 0;
+    int32_t warmStartFaceId = params.restPoseCloestPoint ? -1 : hintFaceId;
+    std::atomic<int64_t>* pCachedClosestFace = nullptr;
+    if (params.warmStartClosestPointRadius && !params.restPoseCloestPoint)
+    {
+        pCachedClosestFace = &closestFaceCaches[tMeshId][vId * tMeshPtrs.size() + idTMIntersected];
+        int64_t cachedClosestFace = pCachedClosestFace->load(std::memory_order_relaxed);
+        int32_t cachedTetId = int32_t(cachedClosestFace >> 32);
+        int32_t cachedFaceId = int32_t(cachedClosestFace & 0xffffffff);
+
+        // the closest face of another embracing tet of the vertex in the same mesh is unlikely to be valid
+        TetMeshFEM* pTMSearch = tMeshPtrs[idTMIntersected].get();
+        bool sameEmbracingRegion = cachedTetId == idTetIntersected;
+        for (int iNei = 0; iNei < 4 && !sameEmbracingRegion && cachedTetId != -1; iNei++)
+        {
+            sameEmbracingRegion = pTMSearch->tetsNeighborTets(iNei, cachedTetId) == idTetIntersected;
+        }
+
+        if (cachedFaceId != -1 && sameEmbracingRegion)
+        {
+            warmStartFaceId = cachedFaceId;
+        }
+    }
+
+    if (warmStartFaceId != -1)
+    {
+        warmStartClosestPointQuery(query, idTMIntersected, warmStartFaceId, pClosestPtResult);
+    }
+
+    RTCPointQueryContext context;
+    rtcInitPointQueryContext(&context);
+    rtcPointQuery(surfaceMeshScenes[idTMIntersected], &query, &context, nullptr, (void*)pClosestPtResult);
+
+    if (pCachedClosestFace != nullptr)
+    {
+        int64_t closestFace = pClosestPtResult->found ?
+            (int64_t(idTetIntersected) << 32) | uint32_t(pClosestPtResult->closestFaceId) : int64_t(-1);
+        pCachedClosestFace->store(closestFace, std::memory_order_relaxed);
+    }
+
+    return pClosestPtResult->found;
+}
+
+void SP::DiscreteCollisionDetector::warmStartClosestPointQuery(RTCPointQuery& query, int32_t idTMIntersected, int32_t cachedFaceId,
+    ClosestPointQueryResult* pClosestPtResult)
+{
+    TetMeshFEM* pTMSearch = tMeshPtrs[idTMIntersected].get();
+    embree::Vec3fa queryPt(query.x, query.y, query.z);
+
+    int32_t faceIds[4] = { cachedFaceId, -1, -1, -1 };
+    int numFaces = 1;
+    for (int iNei = 0; iNei < 3; iNei++)
+    {
+        int32_t neiFaceId = pTMSearch->surfaceFaces3NeighborFaces(iNei, cachedFaceId);
+        if (neiFaceId != -1)
+        {
+            faceIds[numFaces++] = neiFaceId;
+        }
+    }
+
+    Vec3fa closestPts[4];
+    Vec3fa baryCentrics[4];
+    ClosestPointOnTriangleType pointTypes[4];
+    float distances[4];
+    int order[4];
+    for (int iFace = 0; iFace < numFaces; iFace++)
+    {
+        int32_t* faceVIds = pTMSearch->surfaceFacesTetMeshVIds.col(faceIds[iFace]).data();
+        closestPts[iFace] = SP::closestPointTriangle(queryPt, loadVertexPos(pTMSearch, faceVIds[0]), loadVertexPos(pTMSearch, faceVIds[1]),
+            loadVertexPos(pTMSearch, faceVIds[2]), baryCentrics[iFace], pointTypes[iFace]);
+        distances[iFace] = embree::distance(queryPt, closestPts[iFace]);
+
+        int iInsert = iFace;
+        while (iInsert > 0 && distances[order[iInsert - 1]] > distances[iFace])
+        {
+            order[iInsert] = order[iInsert - 1];
+            --iInsert;
+        }
+        order[iInsert] = iFace;
+    }
+
+    // validated the same way as by the BVH callbacks, which then only accept strictly closer candidates
+    RTCPointQueryFunctionArguments args;
+    args.query = &query;
+    args.userPtr = (void*)pClosestPtResult;
+    args.geomID = idTMIntersected;
+    args.context = nullptr;
+    args.similarityScale = 1.f;
+    for (int iCandidate = 0; iCandidate < numFaces; iCandidate++)
+    {
+        int iFace = order[iCandidate];
+        args.primID = faceIds[iFace];
+        if (validateClosestPointCandidate(&args, pClosestPtResult, faceIds[iFace], closestPts[iFace], baryCentrics[iFace],
+            pointTypes[iFace], distances[iFace]))
+        {
+            return;
+        }
+        // the query radius is still infinite, thus the candidate is invalid and would be rejected again
+        pClosestPtResult->warmStartRejectedFaceIds[pClosestPtResult->numWarmStartRejectedFaces++] = faceIds[iFace];
+    }
+}
+
+bool SP::DiscreteCollisionDetector::gatherClosestPointCandidates(RTCPointQuery& query, int32_t idTMIntersected,
+    ClosestPointQueryResult* pClosestPtResult)
+{
+    std::vector<ClosestPointCandidate>& candidates = pClosestPtResult->candidates;
+    candidates.clear();
+    query.radius = embree::inf;
+
+    // each round has the budget of the single BVH query of the eager validation (maxNumberOfBVHQuery)
+    int numberOfBVHQuery = pClosestPtResult->numberOfBVHQuery;
+    pClosestPtResult->numberOfBVHQuery = 0;
+
+    RTCPointQueryContext context;
+    rtcInitPointQueryContext(&context);
+    rtcPointQuery(surfaceMeshScenes[idTMIntersected], &query, &context, nullptr, (void*)pClosestPtResult);
+
+    pClosestPtResult->candidateGatheringGivenUp = pClosestPtResult->numberOfBVHQuery > params.maxNumberOfBVHQuery;
+    pClosestPtResult->numberOfBVHQuery += numberOfBVHQuery;
+    if (pClosestPtResult->candidateGatheringGivenUp)
+    {
+        // the query has been given up by the BVH callback
+        return false;
+    }
+
+    std::sort_heap(candidates.begin(), candidates.end(), closestPointCandidateLess);
+    return true;
+}
+
+void SP::DiscreteCollisionDetector::closestPointQueryEagerFallback(RTCPointQuery& query, int32_t idTMIntersected,
+    ClosestPointQueryResult* pClosestPtResult)
+{
+    int numberOfBVHQuery = pClosestPtResult->numberOfBVHQuery;
+    pClosestPtResult->numberOfBVHQuery = 0;
+    pClosestPtResult->deferTetTraverse = false;
+    pClosestPtResult->numWarmStartRejectedFaces = 0;
+    query.radius = embree::inf;
+
+    RTCPointQueryContext context;
+    rtcInitPointQueryContext(&context);
+    rtcPointQuery(surfaceMeshScenes[idTMIntersected], &query, &context, nullptr, (void*)pClosestPtResult);
+
+    pClosestPtResult->numberOfBVHQuery += numberOfBVHQuery;
+}
+
+void SP::DiscreteCollisionDetector::closestPointQueryLazy(RTCPointQuery& query, int32_t idTMIntersected,
+    ClosestPointQueryResult* pClosestPtResult)
+{
+    embree::Vec3fa queryPt(query.x, query.y, query.z);
+    std::vector<ClosestPointCandidate>& candidates = pClosestPtResult->candidates;
+    bool tetTraverse = pClosestPtResult->checkTetTraverse
+        && (idTMIntersected == pClosestPtResult->idTMQuery || params.tetrahedralTraverseForNonSelfIntersection);
+
+    pClosestPtResult->deferTetTraverse = true;
+    pClosestPtResult->candidateLowerBound = ClosestPointCandidate();
+    pClosestPtResult->candidateQueueSize = params.lazyValidationQueueSize;
+    pClosestPtResult->candidateGatheringGivenUp = false;
+    while (!pClosestPtResult->found)
+    {
+        if (!gatherClosestPointCandidates(query, idTMIntersected, pClosestPtResult))
+        {
+            break;
+        }
+
+        if (tetTraverse && params.packetTraverse)
+            // the nearest success of each packet
+        {
+            for (size_t iFirst = 0; iFirst < candidates.size() && !pClosestPtResult->found; iFirst += TET_TRAVERSE_PACKET_WIDTH)
+            {
+                int32_t numCandidates = int32_t(std::min(candidates.size() - iFirst, size_t(TET_TRAVERSE_PACKET_WIDTH)));
+                bool successes[TET_TRAVERSE_PACKET_WIDTH];
+                tetTraverseFromClosestPoints(pClosestPtResult, idTMIntersected, candidates.data() + iFirst, numCandidates,
+                    queryPt, successes);
+                for (int32_t iCandidate = 0; iCandidate < numCandidates; iCandidate++)
+                {
+                    if (successes[iCandidate])
+                    {
+                        acceptClosestPointCandidate(pClosestPtResult, candidates[iFirst + iCandidate]);
+                        break;
+                    }
+                }
+            }
+        }
+        else
+        {
+            for (const ClosestPointCandidate& candidate : candidates)
+            {
+                if (!tetTraverse
+                    || tetTraverseFromClosestPoint(pClosestPtResult, idTMIntersected, candidate.faceId, queryPt, candidate.closestPt, candidate.pointType))
+                {
+                    acceptClosestPointCandidate(pClosestPtResult, candidate);
+                    break;
+                }
+            }
+        }
+
+        // no farther feasible candidate left
+        if (candidates.size() < pClosestPtResult->candidateQueueSize)
+        {
+            break;
+        }
+        pClosestPtResult->candidateLowerBound = candidates.back();
+        pClosestPtResult->candidateQueueSize *= 2;
+    }
+    pClosestPtResult->deferTetTraverse = false;
+
+    if (pClosestPtResult->candidateGatheringGivenUp)
+    {
+        closestPointQueryEagerFallback(query, idTMIntersected, pClosestPtResult);
+    }
+}
+
+void SP::DiscreteCollisionDetector::closestPointQueryWavefront(BatchCollisionDetectionResult& results, int32_t firstRecord,
+    int32_t numRecords, bool computeClosestPointNormal)
+{
+    BatchThreadLocalData& localData = batchThreadLocalData.local();
+    if (!localData.pLazyValidationWavefront)
+    {
+        localData.pLazyValidationWavefront = std::make_shared<LazyValidationWavefront>();
+    }
+    LazyValidationWavefront& wavefront = *localData.pLazyValidationWavefront;
+
+    wavefront.pDCD = this;
+    wavefront.queries.resize(numRecords);
+    wavefront.closestPtResults.resize(numRecords);
+    wavefront.candidateCursors.assign(numRecords, 0);
+    wavefront.gatheredCandidates.assign(numRecords, false);
+    wavefront.rays.resize(numRecords);
+    wavefront.verdictKeyHashes.assign(numRecords, 0);
+    for (int32_t iRecord = 0; iRecord < numRecords; iRecord++)
+    {
+        ClosestPointQueryResult& closestPtResult = wavefront.closestPtResults[iRecord];
+        int32_t meshId, vId;
+        batchQueryToVertex(results, batchRecordQueryIds[firstRecord + iRecord], meshId, vId);
+
+        closestPtResult.numberOfBVHQuery = 0;
+        closestPtResult.numberOfTetTraversal = 0;
+        closestPtResult.numberOfTetsTraversed = 0;
+        initClosestPointQuery(vId, meshId, results.intersectedTMeshIds[firstRecord + iRecord], results.intersectedTets[firstRecord + iRecord],
+            wavefront.queries[iRecord], &closestPtResult);
+        closestPtResult.candidates.clear();
+        closestPtResult.deferTetTraverse = true;
+        closestPtResult.candidateLowerBound = ClosestPointCandidate();
+        closestPtResult.candidateQueueSize = params.lazyValidationQueueSize;
+        closestPtResult.candidateGatheringGivenUp = false;
+    }
+
+    // one wavefront for each intersected mesh
+    for (int32_t meshId = 0; meshId < int32_t(tMeshPtrs.size()); meshId++)
+    {
+        wavefront.meshId = meshId;
+        wavefront.readyRecords.clear();
+        for (int32_t iRecord = numRecords - 1; iRecord >= 0; iRecord--)
+        {
+            if (results.intersectedTMeshIds[firstRecord + iRecord] == meshId)
+            {
+                wavefront.readyRecords.push_back(iRecord);
+            }
+        }
+        if (wavefront.readyRecords.empty())
+        {
+            continue;
+        }
+
+        TetMeshFEM* pTMSearch = tMeshPtrs[meshId].get();
+        dispatchTraversePolicies(params, [&](auto policies) {
+            typedef decltype(policies) Policies;
+            pTMSearch->tetrahedralTraverseWavefront<typename Policies::StackPolicy, typename Policies::VisitedPolicy,
+                typename Policies::ForwardCheckPolicy>(wavefront, params.wavefrontSize, params.rayTriIntersectionEPSILON);
+        });
+    }
+
+    for (int32_t iRecord = 0; iRecord < numRecords; iRecord++)
+    {
+        ClosestPointQueryResult& closestPtResult = wavefront.closestPtResults[iRecord];
+        closestPtResult.deferTetTraverse = false;
+        if (closestPtResult.candidateGatheringGivenUp)
+        {
+            closestPointQueryEagerFallback(wavefront.queries[iRecord], results.intersectedTMeshIds[firstRecord + iRecord],
+                &closestPtResult);
+        }
+
+        localData.numberOfBVHQuery += closestPtResult.numberOfBVHQuery;
+        localData.numberOfTetTraversal += closestPtResult.numberOfTetTraversal;
+        localData.numberOfTetsTraversed += closestPtResult.numberOfTetsTraversed;
+
+        writeClosestPointRecord(results, firstRecord + iRecord, closestPtResult, computeClosestPointNormal);
+    }
+}
+
+void SP::DiscreteCollisionDetector::closestPointQueryGroup(BatchCollisionDetectionResult& results, int32_t iGroup,
+    bool computeClosestPointNormal)
+{
+    BatchThreadLocalData& localData = batchThreadLocalData.local();
+    ClosestPointQueryGroup& group = localData.closestPtGroup;
+
+    int32_t firstSorted = batchRecordGroupOffsets[iGroup];
+    int32_t numMembers = batchRecordGroupOffsets[iGroup + 1] - firstSorted;
+    int32_t firstRecord = int32_t(batchRecordSortKeys[firstSorted] & 0xffffffff);
+    int32_t idTMIntersected = results.intersectedTMeshIds[firstRecord];
+    int32_t idTetIntersected = results.intersectedTets[firstRecord];
+
+    group.queries.resize(numMembers);
+    group.closestPtResults.resize(numMembers);
+    group.centroidDistances.resize(numMembers);
+    Vec3fa centroid(0.f, 0.f, 0.f);
+    for (int32_t iMember = 0; iMember < numMembers; iMember++)
+    {
+        int32_t iRecord = int32_t(batchRecordSortKeys[firstSorted + iMember] & 0xffffffff);
+        int32_t meshId, vId;
+        batchQueryToVertex(results, batchRecordQueryIds[iRecord], meshId, vId);
+
+        RTCPointQuery& query = group.queries[iMember];
+        ClosestPointQueryResult& closestPtResult = group.closestPtResults[iMember];
+        closestPtResult.numberOfTetTraversal = 0;
+        closestPtResult.numberOfTetsTraversed = 0;
+        closestPtResult.numWarmStartRejectedFaces = 0;
+        initClosestPointQuery(vId, meshId, idTMIntersected, idTetIntersected, query, &closestPtResult);
+        centroid += Vec3fa(query.x, query.y, query.z);
+    }
+
+    // a single record is queried on its own, as is each record of a group whose query has been given up, since then the query
+    // radius of a member may not have been covered
+    bool queryOnOwn = numMembers == 1;
+    if (!queryOnOwn)
+    {
+        centroid = centroid / float(numMembers);
+        for (int32_t iMember = 0; iMember < numMembers; iMember++)
+        {
+            const RTCPointQuery& query = group.queries[iMember];
+            group.centroidDistances[iMember] = embree::distance(centroid, Vec3fa(query.x, query.y, query.z));
+        }
+
+        ClosestPointQueryResult& groupResult = group.groupResult;
+        groupResult.pDCD = this;
+        groupResult.pGroup = &group;
+        groupResult.numberOfBVHQuery = 0;
+
+        RTCPointQuery groupQuery;
+        groupQuery.x = centroid.x;
+        groupQuery.y = centroid.y;
+        groupQuery.z = centroid.z;
+        groupQuery.radius = embree::inf;
+        groupQuery.time = 0.f;
+
+        RTCPointQueryContext context;
+        rtcInitPointQueryContext(&context);
+        rtcPointQuery(surfaceMeshScenes[idTMIntersected], &groupQuery, &context, nullptr, (void*)&groupResult);
+        localData.numberOfBVHQuery += groupResult.numberOfBVHQuery;
+        queryOnOwn = groupResult.numberOfBVHQuery > params.maxNumberOfBVHQuery;
+    }
+
+    ClosestPointQueryResult& ownClosestPtResult = localData.closestPtResult;
+    for (int32_t iMember = 0; iMember < numMembers; iMember++)
+    {
+        int32_t iRecord = int32_t(batchRecordSortKeys[firstSorted + iMember] & 0xffffffff);
+        ClosestPointQueryResult& closestPtResult = group.closestPtResults[iMember];
+        localData.numberOfTetTraversal += closestPtResult.numberOfTetTraversal;
+        localData.numberOfTetsTraversed += closestPtResult.numberOfTetsTraversed;
+        if (!queryOnOwn)
+        {
+            writeClosestPointRecord(results, iRecord, closestPtResult, computeClosestPointNormal);
+            continue;
+        }
+
+        ownClosestPtResult.numberOfBVHQuery = 0;
+        ownClosestPtResult.numberOfTetTraversal = 0;
+        ownClosestPtResult.numberOfTetsTraversed = 0;
+        closestPointQueryReordered(closestPtResult.idVQuery, closestPtResult.idTMQuery, idTMIntersected, idTetIntersected,
+            &ownClosestPtResult);
+
+        localData.numberOfBVHQuery += ownClosestPtResult.numberOfBVHQuery;
+        localData.numberOfTetTraversal += ownClosestPtResult.numberOfTetTraversal;
+        localData.numberOfTetsTraversed += ownClosestPtResult.numberOfTetsTraversed;
+
+        writeClosestPointRecord(results, iRecord, ownClosestPtResult, computeClosestPointNormal);
+    }
+}
+
+void SP::DiscreteCollisionDetector::writeClosestPointRecord(CollisionRecordArrays& records, size_t iRecord,
+    ClosestPointQueryResult& closestPtResult, bool computeClosestPointNormal)
+{
+    if (closestPtResult.found) {
+        records.shortestPathFound[iRecord] = true;
+        records.closestSurfaceFaceId[iRecord] = closestPtResult.closestFaceId;
+        records.closestSurfacePts[iRecord] = { closestPtResult.closestPt.x, closestPtResult.closestPt.y, closestPtResult.closestPt.z };
+        records.closestSurfacePtBarycentrics[iRecord] = { closestPtResult.closestPtBarycentrics.x,
+            closestPtResult.closestPtBarycentrics.y, closestPtResult.closestPtBarycentrics.z };
+        records.closestPointType[iRecord] = closestPtResult.closestPointType;
+
+        if (computeClosestPointNormal)
+        {
+            computeNormal(records.intersectedTMeshIds[iRecord], closestPtResult.closestFaceId, closestPtResult.closestPointType,
+                records.closestPointNormals[iRecord]);
+        }
+    }
+    else
+    {
+        records.shortestPathFound[iRecord] = false;
+        records.closestSurfaceFaceId[iRecord] = -1;
+        records.closestSurfacePts[iRecord] = { -1.f, -1.f, -1.f };
+        records.closestSurfacePtBarycentrics[iRecord] = { -1.f, -1.f, -1.f };
+        records.closestPointType[iRecord] = ClosestPointOnTriangleType::NotFound;
+
+        if (computeClosestPointNormal)
+        {
+            records.closestPointNormals[iRecord] = { 0.f, 0.f, 0.f };
+        }
+    }
+}
+
+inline void copyCollisionRecord(CollisionRecordArrays& dst, size_t iDst, CollisionRecordArrays& src, size_t iSrc,
+    bool computeClosestPointNormal)
+{
+    dst.intersectedTMeshIds[iDst] = src.intersectedTMeshIds[iSrc];
+    dst.intersectedTets[iDst] = src.intersectedTets[iSrc];
+    dst.shortestPathFound[iDst] = src.shortestPathFound[iSrc];
+    dst.closestSurfaceFaceId[iDst] = src.closestSurfaceFaceId[iSrc];
+    dst.closestSurfacePts[iDst] = src.closestSurfacePts[iSrc];
+    dst.closestSurfacePtBarycentrics[iDst] = src.closestSurfacePtBarycentrics[iSrc];
+    dst.closestPointType[iDst] = src.closestPointType[iSrc];
+    if (computeClosestPointNormal)
+    {
+        dst.closestPointNormals[iDst] = src.closestPointNormals[iSrc];
+    }
+}
+
+void SP::DiscreteCollisionDetector::detectAll(const std::vector<int32_t>& meshIds, BatchCollisionDetectionResult& results,
+    bool computeClosestPointNormal)
+{
+    results.clear();
+
+    results.meshIds = meshIds;
+    results.meshQueryOffsets.assign(meshIds.size() + 1, 0);
+    for (size_t iMesh = 0; iMesh < meshIds.size(); iMesh++)
+    {
+        results.meshQueryOffsets[iMesh + 1] = results.meshQueryOffsets[iMesh] + tMeshPtrs[meshIds[iMesh]]->numVertices();
+    }
+
+    int32_t numQueries = results.numQueries();
+    batchQueryPenetrationCounts.resize(numQueries);
+    results.queryOffsets.resize(numQueries + 1);
+
+    for (BatchThreadLocalData& localData : batchThreadLocalData)
+    {
+        localData.records.clear();
+        localData.recordQueryIds.clear();
+        localData.penetrations.clear();
+        localData.numberOfBVHQuery = 0;
+        localData.numberOfTetTraversal = 0;
+        localData.numberOfTetsTraversed = 0;
+    }
+
+    if (params.twoPhaseBatchQuery)
+    {
+        detectAllTwoPhase(results, computeClosestPointNormal);
+    }
+    else
+    {
+        detectAllFused(results, computeClosestPointNormal);
+    }
+
+    for (BatchThreadLocalData& localData : batchThreadLocalData)
+    {
+        results.numberOfBVHQuery += localData.numberOfBVHQuery;
+        results.numberOfTetTraversal += localData.numberOfTetTraversal;
+        results.numberOfTetsTraversed += localData.numberOfTetsTraversed;
+    }
+
+    bool anyReordered = false;
+    for (size_t iMesh = 0; iMesh < tMeshPtrs.size(); iMesh++)
+    {
+        anyReordered = anyReordered || tMeshPtrs[iMesh]->reordered();
+    }
+    if (anyReordered)
+    {
+        // back to the original ids
+        auto translateRecord = [&](int32_t iRecord) {
+            TetMeshFEM* pTM = tMeshPtrs[results.intersectedTMeshIds[iRecord]].get();
+            results.intersectedTets[iRecord] = pTM->originalTetId(results.intersectedTets[iRecord]);
+            if (results.closestSurfaceFaceId[iRecord] != -1)
+            {
+                results.closestSurfaceFaceId[iRecord] = pTM->originalSurfaceFaceId(results.closestSurfaceFaceId[iRecord]);
+            }
+        };
+        cpu_parallel_for(0, (int)results.size(), translateRecord);
+    }
+}
+
+inline void SP::DiscreteCollisionDetector::batchQueryToVertex(const BatchCollisionDetectionResult& results, int32_t iQuery,
+    int32_t& meshId, int32_t& vId)
+{
+    int32_t iMesh = std::upper_bound(results.meshQueryOffsets.begin(), results.meshQueryOffsets.end(), iQuery)
+        - results.meshQueryOffsets.begin() - 1;
+    meshId = results.meshIds[iMesh];
+    vId = tMeshPtrs[meshId]->reorderedVertexId(iQuery - results.meshQueryOffsets[iMesh]);
+}
+
+void SP::DiscreteCollisionDetector::detectAllFused(BatchCollisionDetectionResult& results, bool computeClosestPointNormal)
+{
+    int32_t numQueries = results.numQueries();
+
+    auto queryVertex = [&](int32_t iQuery) {
+        int32_t meshId, vId;
+        batchQueryToVertex(results, iQuery, meshId, vId);
+        batchQueryPenetrationCounts[iQuery] = 0;
+
+        if (!tMeshPtrs[meshId]->verticesCollisionDetectionEnabled[vId])
+        {
+            return;
+        }
+
+        BatchThreadLocalData& localData = batchThreadLocalData.local();
+        CollisionDetectionResult& colResult = localData.colResult;
+        ClosestPointQueryResult& closestPtResult = localData.closestPtResult;
+        CollisionRecordArrays& records = localData.records;
+
+        vertexCollisionDetectionReordered(vId, meshId, &colResult);
+        batchQueryPenetrationCounts[iQuery] = colResult.numIntersections();
+        if (!colResult.numIntersections())
+        {
+            return;
+        }
+
+        for (int iIntersection = 0; iIntersection < colResult.numIntersections(); iIntersection++)
+        {
+            size_t iRecord = records.size();
+            records.resize(iRecord + 1, computeClosestPointNormal);
+            records.intersectedTMeshIds[iRecord] = colResult.intersectedTMeshIds[iIntersection];
+            records.intersectedTets[iRecord] = colResult.intersectedTets[iIntersection];
+            localData.recordQueryIds.push_back(iQuery);
+
+            // the same budget per record as the two phase query
+            closestPtResult.numberOfBVHQuery = 0;
+            closestPtResult.numberOfTetTraversal = 0;
+            closestPtResult.numberOfTetsTraversed = 0;
+            closestPointQueryReordered(vId, meshId, records.intersectedTMeshIds[iRecord], records.intersectedTets[iRecord],
+                &closestPtResult);
+            writeClosestPointRecord(records, iRecord, closestPtResult, computeClosestPointNormal);
+
+            localData.numberOfBVHQuery += closestPtResult.numberOfBVHQuery;
+            localData.numberOfTetTraversal += closestPtResult.numberOfTetTraversal;
+            localData.numberOfTetsTraversed += closestPtResult.numberOfTetsTraversed;
+        }
+    };
+    cpu_parallel_for(0, numQueries, queryVertex);
+
+    int32_t numRecords = embree::parallel_prefix_sum(batchQueryPenetrationCounts, results.queryOffsets, numQueries, 0,
+        std::plus<int32_t>());
+    results.queryOffsets[numQueries] = numRecords;
+    results.resize(numRecords, computeClosestPointNormal);
+
+    std::vector<BatchThreadLocalData*> threadLocalData;
+    for (BatchThreadLocalData& localData : batchThreadLocalData)
+    {
+        threadLocalData.push_back(&localData);
+    }
+
+    // scatter the per-thread outputs to the CSR layout, the records of a vertex are contiguous in the buffer of the thread that queried it
+    auto scatterRecords = [&](int32_t iThread) {
+        BatchThreadLocalData& localData = *threadLocalData[iThread];
+        int32_t iIntersection = 0;
+        for (size_t iRecord = 0; iRecord < localData.recordQueryIds.size(); iRecord++)
+        {
+            int32_t iQuery = localData.recordQueryIds[iRecord];
+            if (iRecord && localData.recordQueryIds[iRecord - 1] != iQuery)
+            {
+                iIntersection = 0;
+            }
+            copyCollisionRecord(results, results.queryOffsets[iQuery] + iIntersection, localData.records, iRecord,
+                computeClosestPointNormal);
+            ++iIntersection;
+        }
+    };
+    cpu_parallel_for(0, threadLocalData.size(), scatterRecords);
+}
+
+void SP::DiscreteCollisionDetector::detectAllTwoPhase(BatchCollisionDetectionResult& results, bool computeClosestPointNormal)
+{
+    int32_t numQueries = results.numQueries();
+
+    // phase 1: tet inclusion query for all the vertices, embracing tets are buffered per thread
+    auto inclusionQuery = [&](int32_t iQuery) {
+        int32_t meshId, vId;
+        batchQueryToVertex(results, iQuery, meshId, vId);
+        batchQueryPenetrationCounts[iQuery] = 0;
+
+        if (!tMeshPtrs[meshId]->verticesCollisionDetectionEnabled[vId])
+        {
+            return;
+        }
+
+        BatchThreadLocalData& localData = batchThreadLocalData.local();
+        CollisionDetectionResult& colResult = localData.colResult;
+
+        vertexCollisionDetectionReordered(vId, meshId, &colResult);
+        batchQueryPenetrationCounts[iQuery] = colResult.numIntersections();
+        for (int iIntersection = 0; iIntersection < colResult.numIntersections(); iIntersection++)
+        {
+            localData.penetrations.push_back({ iQuery, colResult.intersectedTMeshIds[iIntersection], colResult.intersectedTets[iIntersection] });
+        }
+    };
+    cpu_parallel_for(0, numQueries, inclusionQuery);
+
+    // compaction: the exclusive prefix sum of the counts gives each penetrating vertex its slot in the output
+    int32_t numPenetrations = embree::parallel_prefix_sum(batchQueryPenetrationCounts, results.queryOffsets, numQueries, 0,
+        std::plus<int32_t>());
+    results.queryOffsets[numQueries] = numPenetrations;
+    results.resize(numPenetrations, computeClosestPointNormal);
+    batchRecordQueryIds.resize(numPenetrations);
+
+    std::vector<std::vector<PenetrationCandidate>*> threadPenetrations;
+    for (BatchThreadLocalData& localData : batchThreadLocalData)
+    {
+        threadPenetrations.push_back(&localData.penetrations);
+    }
+
+    auto scatterPenetrations = [&](int32_t iThread) {
+        std::vector<PenetrationCandidate>& penetrations = *threadPenetrations[iThread];
+        // the embracing tets of a vertex are contiguous in the buffer of the thread that queried it
+        int32_t iIntersection = 0;
+        for (size_t iPenetration = 0; iPenetration < penetrations.size(); iPenetration++)
+        {
+            const PenetrationCandidate& penetration = penetrations[iPenetration];
+            if (iPenetration && penetrations[iPenetration - 1].iQuery != penetration.iQuery)
+            {
+                iIntersection = 0;
+            }
+            int32_t iRecord = results.queryOffsets[penetration.iQuery] + iIntersection;
+            batchRecordQueryIds[iRecord] = penetration.iQuery;
+            results.intersectedTMeshIds[iRecord] = penetration.intersectedTMeshId;
+            results.intersectedTets[iRecord] = penetration.intersectedTet;
+            ++iIntersection;
+        }
+    };
+    cpu_parallel_for(0, threadPenetrations.size(), scatterPenetrations);
+
+    // phase 2: closest point query on the compacted list, each (vertex, embracing tet) pair is an independent task
+    auto closestPointQueryForPenetration = [&](int32_t iRecord) {
+        BatchThreadLocalData& localData = batchThreadLocalData.local();
+        ClosestPointQueryResult& closestPtResult = localData.closestPtResult;
+
+        int32_t meshId, vId;
+        batchQueryToVertex(results, batchRecordQueryIds[iRecord], meshId, vId);
+
+        closestPtResult.numberOfBVHQuery = 0;
+        closestPtResult.numberOfTetTraversal = 0;
+        closestPtResult.numberOfTetsTraversed = 0;
+        closestPointQueryReordered(vId, meshId, results.intersectedTMeshIds[iRecord], results.intersectedTets[iRecord],
+            &closestPtResult);
+
+        localData.numberOfBVHQuery += closestPtResult.numberOfBVHQuery;
+        localData.numberOfTetTraversal += closestPtResult.numberOfTetTraversal;
+        localData.numberOfTetsTraversed += closestPtResult.numberOfTetsTraversed;
+
+        writeClosestPointRecord(results, iRecord, closestPtResult, computeClosestPointNormal);
+    };
+
+    if (params.wavefrontTraverse && params.lazyClosestPointValidation && !params.restPoseCloestPoint)
+        // blocks of wavefrontSize records
+    {
+        int32_t numBlocks = (numPenetrations + params.wavefrontSize - 1) / params.wavefrontSize;
+        auto closestPointQueryForBlock = [&](int32_t iBlock) {
+            int32_t firstRecord = iBlock * params.wavefrontSize;
+            closestPointQueryWavefront(results, firstRecord, std::min(params.wavefrontSize, numPenetrations - firstRecord),
+                computeClosestPointNormal);
+        };
+        cpu_parallel_for(0, numBlocks, closestPointQueryForBlock);
+        return;
+    }
+
+    if (!params.groupQueriesByEmbracingTet || params.lazyClosestPointValidation || params.restPoseCloestPoint)
+    {
+        cpu_parallel_for(0, numPenetrations, closestPointQueryForPenetration);
+        return;
+    }
+
+    // the records are sorted by embracing tet, the record id in the low bits keeps each group in record order
+    std::vector<int32_t> tetIdOffsets(tMeshPtrs.size(), 0);
+    for (size_t iMesh = 1; iMesh < tMeshPtrs.size(); iMesh++)
+    {
+        tetIdOffsets[iMesh] = tetIdOffsets[iMesh - 1] + tMeshPtrs[iMesh - 1]->numTets();
+    }
+
+    batchRecordSortKeys.resize(numPenetrations);
+    batchRecordSortBuffer.resize(numPenetrations);
+    auto buildSortKey = [&](int32_t iRecord) {
+        uint32_t globalTetId = tetIdOffsets[results.intersectedTMeshIds[iRecord]] + results.intersectedTets[iRecord];
+        batchRecordSortKeys[iRecord] = (uint64_t(globalTetId) << 32) | uint32_t(iRecord);
+    };
+    cpu_parallel_for(0, numPenetrations, buildSortKey);
+    embree::radix_sort<uint64_t>(batchRecordSortKeys.data(), batchRecordSortBuffer.data(), numPenetrations);
+
+    batchRecordGroupOffsets.clear();
+    for (int32_t iSorted = 0; iSorted < numPenetrations; iSorted++)
+    {
+        if (!iSorted || (batchRecordSortKeys[iSorted] >> 32) != (batchRecordSortKeys[iSorted - 1] >> 32))
+        {
+            batchRecordGroupOffsets.push_back(iSorted);
+        }
+    }
+    int32_t numGroups = batchRecordGroupOffsets.size();
+    batchRecordGroupOffsets.push_back(numPenetrations);
+
+    auto closestPointQueryForGroup = [&](int32_t iGroup) {
+        closestPointQueryGroup(results, iGroup, computeClosestPointNormal);
+    };
+    cpu_parallel_for(0, numGroups, closestPointQueryForGroup);
+}
+
+inline void setHalfSpace(FloatingType* halfSpaces, int iHalfSpace, const Vec3fa& normal, float offset)
+{
+    halfSpaces[iHalfSpace] = normal.x;
+    halfSpaces[4 + iHalfSpace] = normal.y;
+    halfSpaces[8 + iHalfSpace] = normal.z;
+    halfSpaces[12 + iHalfSpace] = offset;
+}
+
+void SP::DiscreteCollisionDetector::updateFeasibleRegionTable(int32_t meshId)
+{
+    TetMeshFEM* pTM = tMeshPtrs[meshId].get();
+    FeasibleRegionTable& table = feasibleRegionTables[meshId];
+    const float feasibleRegionEpsilon = params.feasibleRegionEpsilon;
+
+    if (table.vertexBlockOffsets.size() != pTM->numSurfaceVerts() + 1)
+    {
+        table.vertexBlockOffsets.resize(pTM->numSurfaceVerts() + 1);
+        table.vertexBlockOffsets[0] = 0;
+        for (int32_t surfaceVId = 0; surfaceVId < pTM->numSurfaceVerts(); surfaceVId++)
+        {
+            int32_t numNeighbors = pTM->surfaceVertexNeighborSurfaceVertices[surfaceVId].size();
+            table.vertexBlockOffsets[surfaceVId + 1] = table.vertexBlockOffsets[surfaceVId] + (numNeighbors + 3) / 4;
+        }
+        table.vertexHalfSpaces.resize(16, table.vertexBlockOffsets.back());
+        table.edgeHalfSpaces.resize(16, 3 * pTM->numSurfaceFaces());
+    }
+
+    // the same half spaces as checkEdgeFeasibleRegion, dot(p - A, n) >= relaxed is stored as dot(p, n) - dot(A, n) - relaxed >= 0
+    auto computeEdgeHalfSpaces = [&](int32_t faceId) {
+        int32_t* faceVIds = pTM->surfaceFacesTetMeshVIds.col(faceId).data();
+        for (int32_t edgeId = 0; edgeId < 3; edgeId++)
+        {
+            FloatingType* halfSpaces = table.edgeHalfSpaces.col(3 * faceId + edgeId).data();
+            int32_t neighborFaceId = pTM->surfaceFaces3NeighborFaces(edgeId, faceId);
+            if (neighborFaceId == -1) {
+                // boundary edge, no filtering
+                table.edgeHalfSpaces.col(3 * faceId + edgeId).setZero();
+                continue;
+            }
+
+            Vec3fa A = loadVertexPos(pTM, faceVIds[edgeId]);
+            Vec3fa B = loadVertexPos(pTM, faceVIds[(edgeId + 1) % 3]);
+            // we are looking form the inside of the mesh, thus the face normal shoud be inverted
+            Vec3fa fNormal1 = -faceNormal(pTM, faceId);
+            Vec3fa fNormal2 = -faceNormal(pTM, neighborFaceId);
+
+            Vec3fa AB = B - A;
+            Vec3fa BA = -AB;
+            float relaxed = -(embree::sqr_length(AB)) * feasibleRegionEpsilon - ABSOLUTE_RELAXIATION;
+
+            Vec3fa nAB = cross(fNormal1, AB);
+            Vec3fa nBA = cross(fNormal2, BA);
+
+            setHalfSpace(halfSpaces, 0, AB, -embree::dot(A, AB) - relaxed);
+            setHalfSpace(halfSpaces, 1, BA, -embree::dot(B, BA) - relaxed);
+            setHalfSpace(halfSpaces, 2, nAB, -embree::dot(A, nAB) - relaxed);
+            setHalfSpace(halfSpaces, 3, nBA, -embree::dot(A, nBA) - relaxed);
+        }
+    };
+    cpu_parallel_for(0, pTM->numSurfaceFaces(), computeEdgeHalfSpaces);
+
+    // the same half spaces as checkVertexFeasibleRegion
+    auto computeVertexHalfSpaces = [&](int32_t surfaceVId) {
+        Vec3fa A = loadVertexPos(pTM, pTM->surfaceVIds(surfaceVId));
+        const std::vector<IdType>& neighborVIds = pTM->surfaceVertexNeighborSurfaceVertices[surfaceVId];
+
+        int32_t firstBlock = table.vertexBlockOffsets[surfaceVId];
+        table.vertexHalfSpaces.middleCols(firstBlock, table.vertexBlockOffsets[surfaceVId + 1] - firstBlock).setZero();
+        for (int32_t iVNei = 0; iVNei < neighborVIds.size(); ++iVNei) {
+            Vec3fa B = loadVertexPos(pTM, neighborVIds[iVNei]);
+            Vec3fa BA = A - B;
+            float relaxed = -(embree::dot(BA, BA)) * feasibleRegionEpsilon - ABSOLUTE_RELAXIATION;
+
+            setHalfSpace(table.vertexHalfSpaces.col(firstBlock + iVNei / 4).data(), iVNei % 4, BA, -embree::dot(A, BA) - relaxed);
+        }
+    };
+    cpu_parallel_for(0, pTM->numSurfaceVerts(), computeVertexHalfSpaces);
+}
+
+bool SP::DiscreteCollisionDetector::checkFeasibleRegionFromTable(const embree::Vec3fa& p, int32_t meshId, int32_t faceId,
+    ClosestPointOnTriangleType pointType)
+{
+    TetMeshFEM* pTM = tMeshPtrs[meshId].get();
+    const FeasibleRegionTable& table = feasibleRegionTables[meshId];
+    const embree::vfloat4 zero(0.f);
+
+    int32_t edgeId = -1;
+    int32_t vertexId = -1;
+    switch (pointType)
+    {
+    case ClosestPointOnTriangleType::AtInterior:
+        // this is automatically satisfied
+        return true;
+    case ClosestPointOnTriangleType::AtAB:
+        edgeId = 0;
+        break;
+    case ClosestPointOnTriangleType::AtBC:
+        edgeId = 1;
+        break;
+    case ClosestPointOnTriangleType::AtAC:
+        edgeId = 2;
+        break;
+    case ClosestPointOnTriangleType::AtA:
+        vertexId = 0;
+        break;
+    case ClosestPointOnTriangleType::AtB:
+        vertexId = 1;
+        break;
+    case ClosestPointOnTriangleType::AtC:
+        vertexId = 2;
+        break;
+    default:
+        return false;
+    }
+
+    if (edgeId != -1)
+    {
+        return embree::all(planes4SignedDistances(p.x, p.y, p.z, table.edgeHalfSpaces.col(3 * faceId + edgeId).data()) >= zero);
+    }
+
+    int32_t surfaceVId = pTM->tetVertIndicesToSurfaceVertIndices(pTM->surfaceFacesTetMeshVIds(vertexId, faceId));
+    assert(surfaceVId != -1);
+    for (int32_t iBlock = table.vertexBlockOffsets[surfaceVId]; iBlock < table.vertexBlockOffsets[surfaceVId + 1]; iBlock++)
+    {
+        if (!embree::all(planes4SignedDistances(p.x, p.y, p.z, table.vertexHalfSpaces.col(iBlock).data()) >= zero))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool SP::DiscreteCollisionDetector::checkFeasibleRegion(embree::Vec3fa& p, TetMeshFEM* pTM, int32_t faceId,
     ClosestPointOnTriangleType pointType, float feasibleRegionEpsilon)
 {
@@ -779,14 +2805,16 @@ bool SP::DiscreteCollisionDetector::checkFeasibleRegion(embree::Vec3fa& p, TetMe
 
 void SP::DiscreteCollisionDetector::computeNormal(CollisionDetectionResult& colResult, int32_t iIntersection, std::array<float, 3>& normalOut)
 {
-    ClosestPointOnTriangleType pointType = colResult.closestPointType[iIntersection];
-    int32_t curVertID = colResult.idVQuery;
-    int32_t curMeshID = colResult.idTMQuery;
+    int32_t intersectedTMeshId = colResult.intersectedTMeshIds[iIntersection];
+    computeNormal(intersectedTMeshId,
+        tMeshPtrs[intersectedTMeshId]->reorderedSurfaceFaceId(colResult.closestSurfaceFaceId[iIntersection]),
+        colResult.closestPointType[iIntersection], normalOut);
+}
 
-    int32_t collidedMeshID = colResult.intersectedTMeshIds[iIntersection];
-    int32_t closestFaceId = colResult.closestSurfaceFaceId[iIntersection];
-    TetMeshFEM* pCurTM = tMeshPtrs[curMeshID].get();
-    TetMeshFEM* pIntersectedTM = tMeshPtrs[collidedMeshID].get();
+void SP::DiscreteCollisionDetector::computeNormal(int32_t intersectedTMeshId, int32_t closestFaceId, ClosestPointOnTriangleType pointType,
+    std::array<float, 3>& normalOut)
+{
+    TetMeshFEM* pIntersectedTM = tMeshPtrs[intersectedTMeshId].get();
 
     Vec3 normal;
     int32_t surfaceVIdTMeshIndex = -1;
@@ -844,7 +2872,7 @@ bool SP::checkEdgeFeasibleRegion(embree::Vec3fa& p, TetMeshFEM* pTM, int32_t fac
     //M::FPtr pF1 = M::halfedgeFace(pHE1);
     //M::FPtr pF2 = M::halfedgeFace(pHE2);
 
-    int32_t neighborFaceId = pTM->surfaceFaces3NeighborFaces(edgeId);
+    int32_t neighborFaceId = pTM->surfaceFaces3NeighborFaces(edgeId, faceId);
 
     embree::Vec3fa v1 = loadVertexPos(pTM, edgeVId1);
     embree::Vec3fa v2 = loadVertexPos(pTM, edgeVId2);
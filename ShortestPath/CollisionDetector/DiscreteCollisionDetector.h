@@ -1,8 +1,11 @@
 #pragma once
 
 #include <vector>
+#include <array>
 #include <memory>
+#include <atomic>
 #include <embree3/rtcore.h>
+#include "oneapi/tbb/enumerable_thread_specific.h"
 
 #include "../common/math/vec2.h"
 #include "../common/math/vec3.h"
@@ -11,10 +14,40 @@
 #include "../common/math/constants.h"
 
 #include "CollisionDetertionParameters.h"
+#include "../Types/Types.h"
+
+// max number of embracing tets of a vertex kept by the warm start cache (see warmStartEmbracingTets)
+#define WARM_START_MAX_EMBRACING_TETS 4
+
+// max number of surface faces in a leaf of the leaf batched surface BVH (see leafBatchedClosestPoint)
+// a cluster fills exactly one SIMD register of closestPointTriangleN
+#if defined(__AVX__)
+#define SURFACE_FACE_CLUSTER_SIZE 8
+#else
+#define SURFACE_FACE_CLUSTER_SIZE 4
+#endif
 
 namespace SP {
     struct TetMeshFEM;
     struct DiscreteCollisionDetector;
+    struct ClosestPointQueryGroup;
+    struct LazyValidationWavefront;
+
+    // a feasible closest point candidate gathered by the lazy validation (see lazyClosestPointValidation)
+    struct ClosestPointCandidate
+    {
+        float distance = -1.f;
+        int32_t faceId = -1;
+        embree::Vec3fa closestPt;
+        embree::Vec3fa closestPtBarycentrics;
+        ClosestPointOnTriangleType pointType;
+    };
+
+    // orders the candidates by distance, ties are broken by face id
+    inline bool closestPointCandidateLess(const ClosestPointCandidate& a, const ClosestPointCandidate& b)
+    {
+        return a.distance < b.distance || (a.distance == b.distance && a.faceId < b.faceId);
+    }
 
     struct ClosestPointQueryResult
     {
@@ -35,6 +68,20 @@ namespace SP {
 
         bool checkFeasibleRegion = false;
         bool checkTetTraverse = true;
+        // lazy validation: the BVH query gathers the nearest feasible candidates after candidateLowerBound into a bounded max heap
+        // instead of tet traversing them, see DiscreteCollisionDetector::closestPointQueryLazy
+        bool deferTetTraverse = false;
+        std::vector<ClosestPointCandidate> candidates;
+        ClosestPointCandidate candidateLowerBound;
+        // size of the heap of the current round, doubled at each round from lazyValidationQueueSize
+        size_t candidateQueueSize = 1;
+        // the last round of candidate gathering has been given up (maxNumberOfBVHQuery)
+        bool candidateGatheringGivenUp = false;
+        // warmStartClosestPointRadius: faces already rejected by the warm start, skipped by the BVH callbacks
+        int32_t warmStartRejectedFaceIds[4];
+        int numWarmStartRejectedFaces = 0;
+        // groupQueriesByEmbracingTet: the group whose candidates are gathered by the BVH query of this result
+        ClosestPointQueryGroup* pGroup = nullptr;
 
         DiscreteCollisionDetector* pDCD = nullptr;
 
@@ -50,6 +97,194 @@ namespace SP {
 
     };
 
+    // struct-of-arrays storage of (query vertex, embracing tet) intersections and their closest surface points
+    struct CollisionRecordArrays
+    {
+        size_t size() { return intersectedTets.size(); }
+        void resize(size_t numRecords, bool withNormals) {
+            intersectedTMeshIds.resize(numRecords);
+            intersectedTets.resize(numRecords);
+            shortestPathFound.resize(numRecords);
+            closestSurfaceFaceId.resize(numRecords);
+            closestSurfacePts.resize(numRecords);
+            closestSurfacePtBarycentrics.resize(numRecords);
+            closestPointType.resize(numRecords);
+            closestPointNormals.resize(withNormals ? numRecords : 0);
+        }
+        // does not release the memory, thus the arrays can be refilled without allocation
+        void clear() { resize(0, false); }
+
+        std::vector<int32_t> intersectedTMeshIds;
+        std::vector<int32_t> intersectedTets;
+        // int8_t instead of bool, to avoid the bit packed std::vector<bool>
+        std::vector<int8_t> shortestPathFound;
+        std::vector<int32_t> closestSurfaceFaceId;
+        std::vector<std::array<float, 3>> closestSurfacePts;
+        std::vector<std::array<float, 3>> closestSurfacePtBarycentrics;
+        std::vector<ClosestPointOnTriangleType> closestPointType;
+        // only filled when detectAll is called with computeNormal = true
+        std::vector<std::array<float, 3>> closestPointNormals;
+    };
+
+    // CSR output of the batch query over whole meshes: the vertices of all the query meshes are flattened
+    // into a single query index space, the intersections of query iQuery are [queryOffsets[iQuery], queryOffsets[iQuery + 1])
+    // the query vertices, tets and surface faces are indexed by the original ids of the meshes reordered for locality
+    // (ObjectParams::reorderForLocality)
+    struct BatchCollisionDetectionResult : public CollisionRecordArrays
+    {
+        void clear() {
+            CollisionRecordArrays::clear();
+            numberOfBVHQuery = 0;
+            numberOfTetTraversal = 0;
+            numberOfTetsTraversed = 0;
+        }
+
+        size_t numQueries() { return meshQueryOffsets.back(); }
+        int32_t queryId(int32_t iMesh, int32_t vId) { return meshQueryOffsets[iMesh] + vId; }
+        int32_t numIntersections(int32_t iQuery) { return queryOffsets[iQuery + 1] - queryOffsets[iQuery]; }
+
+        // meshIds passed to detectAll and the first query index of each of them, size: meshIds.size() + 1
+        std::vector<int32_t> meshIds;
+        std::vector<int32_t> meshQueryOffsets;
+        // size: numQueries() + 1
+        std::vector<int32_t> queryOffsets;
+
+        int numberOfBVHQuery = 0;
+        int numberOfTetTraversal = 0;
+        int numberOfTetsTraversed = 0;
+    };
+
+    // groupQueriesByEmbracingTet: the closest point queries of a group of records sharing an embracing tet, their candidates
+    // are gathered by a single BVH query around the centroid of the query points (see closestPointQueryGroup)
+    struct ClosestPointQueryGroup
+    {
+        // - per member of the group
+        std::vector<RTCPointQuery> queries;
+        std::vector<ClosestPointQueryResult> closestPtResults;
+        // distance of the query point to the centroid
+        std::vector<float> centroidDistances;
+
+        // userPtr of the BVH query of the group
+        ClosestPointQueryResult groupResult;
+    };
+
+    // a (query vertex, embracing tet) pair found by the inclusion phase of the two phase batch query
+    struct PenetrationCandidate
+    {
+        int32_t iQuery;
+        int32_t intersectedTMeshId;
+        int32_t intersectedTet;
+    };
+
+    // scratch storage owned by each worker thread of the batch query, reused across calls
+    struct BatchThreadLocalData
+    {
+        CollisionDetectionResult colResult;
+        ClosestPointQueryResult closestPtResult;
+        ClosestPointQueryGroup closestPtGroup;
+        // wavefrontTraverse: the records of the block validated by this thread, allocated by its first block
+        std::shared_ptr<LazyValidationWavefront> pLazyValidationWavefront;
+        // fused pipeline: intersections found by this thread and their query ids, scattered to the CSR output at the end
+        CollisionRecordArrays records;
+        std::vector<int32_t> recordQueryIds;
+        // two phase pipeline: embracing tets found by this thread in the inclusion phase
+        std::vector<PenetrationCandidate> penetrations;
+
+        int numberOfBVHQuery = 0;
+        int numberOfTetTraversal = 0;
+        int numberOfTetsTraversed = 0;
+    };
+
+    // embracing tets found for a vertex at the last step, numTets = -1 if there were more than WARM_START_MAX_EMBRACING_TETS
+    struct EmbracingTetCache
+    {
+        int32_t numTets = 0;
+        // number of steps warm started since the last BVH query of the vertex
+        int32_t numWarmStarts = 0;
+        std::array<int32_t, WARM_START_MAX_EMBRACING_TETS> meshIds;
+        std::array<int32_t, WARM_START_MAX_EMBRACING_TETS> tetIds;
+    };
+
+    // per-step lock-free cache of tet traversal verdicts (see cacheTraversalVerdicts), open addressing with linear probing
+    // an entry packs a 63 bits fingerprint of the key hash with the verdict in the lowest bit, 0 means empty
+    struct TraversalVerdictCache
+    {
+        static const int maxNumProbes = 16;
+
+        void resize(int log2Size) {
+            entries = std::vector<std::atomic<uint64_t>>(size_t(1) << log2Size);
+            mask = entries.size() - 1;
+            clear();
+        }
+        void clear() {
+            for (std::atomic<uint64_t>& entry : entries) {
+                entry.store(0, std::memory_order_relaxed);
+            }
+        }
+        // returns -1 if the key is not cached, otherwise the verdict
+        int lookup(uint64_t keyHash) {
+            const uint64_t fingerprint = (keyHash | 2) & ~uint64_t(1);
+            for (int iProbe = 0; iProbe < maxNumProbes; iProbe++) {
+                uint64_t entry = entries[(keyHash + iProbe) & mask].load(std::memory_order_relaxed);
+                if (entry == 0) {
+                    return -1;
+                }
+                if ((entry & ~uint64_t(1)) == fingerprint) {
+                    return int(entry & 1);
+                }
+            }
+            return -1;
+        }
+        // the verdict is dropped if the probed slots are full
+        void insert(uint64_t keyHash, bool success) {
+            const uint64_t fingerprint = (keyHash | 2) & ~uint64_t(1);
+            for (int iProbe = 0; iProbe < maxNumProbes; iProbe++) {
+                uint64_t entry = 0;
+                if (entries[(keyHash + iProbe) & mask].compare_exchange_strong(entry, fingerprint | uint64_t(success),
+                    std::memory_order_relaxed) || (entry & ~uint64_t(1)) == fingerprint) {
+                    return;
+                }
+            }
+        }
+
+        std::vector<std::atomic<uint64_t>> entries;
+        uint64_t mask = 0;
+    };
+
+    // per-step bound of the feasible regions of all the surface elements (faces, edges and vertices) of a face cluster:
+    // a point x of the cluster can only be the closest point to p if the line of p - x is within the half angle of the axis
+    // line, for any x in the bounding sphere (center, radius) of the cluster
+    // cosHalfAngle = 0 means the cone can not exclude any point
+    struct SurfaceFaceClusterNormalCone
+    {
+        embree::Vec3fa axis;
+        embree::Vec3fa center;
+        float cosHalfAngle = 0.f;
+        float sinHalfAngle = 1.f;
+        float radius = 0.f;
+    };
+
+    // neighboring surface faces of a mesh grouped in clusters, each cluster is a single primitive in the surface BVH
+    struct SurfaceFaceClusters
+    {
+        TetMeshFEM* pTM = nullptr;
+        // surface face ids of each cluster, padded with -1
+        std::vector<std::array<int32_t, SURFACE_FACE_CLUSTER_SIZE>> faceIds;
+        // only filled with normalConePruning, a cone for each cluster
+        std::vector<SurfaceFaceClusterNormalCone> normalCones;
+    };
+
+    // per-step feasible region half spaces of a surface mesh, a point p is in the feasible region of a surface edge / vertex
+    // iff n.p + d >= 0 for all of its half spaces, the relaxation by feasibleRegionEpsilon is included in d
+    // half spaces are stored in blocks of 4, in the layout of TPlanes4Mat; blocks are padded with zero half spaces
+    struct FeasibleRegionTable
+    {
+        // 3 x numSurfaceFaces blocks, the 4 half spaces of edge edgeId (AB, BC, CA) of face faceId are block 3 * faceId + edgeId
+        TPlanes4Mat edgeHalfSpaces;
+        // the half spaces of surface vertex surfaceVId are blocks [vertexBlockOffsets[surfaceVId], vertexBlockOffsets[surfaceVId + 1])
+        std::vector<int32_t> vertexBlockOffsets;
+        TPlanes4Mat vertexHalfSpaces;
+    };
 
 	struct DiscreteCollisionDetector
 	{
@@ -59,13 +294,75 @@ namespace SP {
         void updateBVH(RTCBuildQuality tetMeshSceneQuality, RTCBuildQuality surfaceSceneQuality
             , bool updateSurfaceScene);
 
+        // the vertex, tet and surface face ids taken and returned by vertexCollisionDetection, closestPointQuery and
+        // computeNormal(CollisionDetectionResult&, ...) are the original ids of the meshes reordered for locality
+        // (ObjectParams::reorderForLocality), as the ones of detectAll; the other functions speak the reordered ids
         // vId: index of tetmesh vertex (not surface vertex, this also works for interior verts)
         bool vertexCollisionDetection(int32_t vId, int32_t tMeshId, CollisionDetectionResult* pResult);
+        // vertexCollisionDetection in the reordered ids
+        bool vertexCollisionDetectionReordered(int32_t vId, int32_t tMeshId, CollisionDetectionResult* pResult);
+        // warm start of vertexCollisionDetection: walks from each of the last embracing tets of the vertex to the tet containing
+        // it, returns false if any walk fails, in which case the BVH query is needed
+        bool warmStartVertexCollisionDetection(int32_t vId, int32_t tMeshId, CollisionDetectionResult* pResult);
+        // point location walk in mesh tMeshId from tet startTetId towards p, crossing the face of the most negative barycentric;
+        // returns the tet containing p, or -1 if the walk leaves the mesh or exceeds warmStartWalkBudget tets
+        int32_t walkToEmbracingTet(const FloatingType* p, int32_t tMeshId, int32_t startTetId);
         bool closestPointQuery(CollisionDetectionResult* pResult, ClosestPointQueryResult* pClosestPtResult, bool computeNormal=false);
+        // closest point query for a single intersection: vertex vId of mesh tMeshId embraced by tet idTetIntersected of mesh idTMIntersected
+        // hintFaceId: a face of mesh idTMIntersected to warm start from (see warmStartClosestPointQuery) when there is no cached one
+        bool closestPointQuery(int32_t vId, int32_t tMeshId, int32_t idTMIntersected, int32_t idTetIntersected,
+            ClosestPointQueryResult* pClosestPtResult, int32_t hintFaceId = -1);
+        // closestPointQuery in the reordered ids
+        bool closestPointQueryReordered(int32_t vId, int32_t tMeshId, int32_t idTMIntersected, int32_t idTetIntersected,
+            ClosestPointQueryResult* pClosestPtResult, int32_t hintFaceId = -1);
+
+        // runs vertexCollisionDetection + closestPointQuery for every collision-enabled vertex of the given meshes
+        // in parallel; the BVHs must be up to date (see updateBVH)
+        void detectAll(const std::vector<int32_t>& meshIds, BatchCollisionDetectionResult& results, bool computeNormal = false);
+        // both phases interleaved for each vertex
+        void detectAllFused(BatchCollisionDetectionResult& results, bool computeNormal);
+        // inclusion query for all the vertices first, then closest point query on the compacted penetrating vertices
+        void detectAllTwoPhase(BatchCollisionDetectionResult& results, bool computeNormal);
+        // warmStartClosestPointRadius: validates the closest points on the cached face and its 3 neighbor faces from the nearest
+        // one, the first valid one becomes the initial result and query radius
+        void warmStartClosestPointQuery(RTCPointQuery& query, int32_t idTMIntersected, int32_t cachedFaceId,
+            ClosestPointQueryResult* pClosestPtResult);
+        // closest point query of lazyClosestPointValidation: the feasible candidates are gathered in distance order by rounds of
+        // lazyValidationQueueSize doubled at each round, then tet traversed from the nearest one until the first success
+        void closestPointQueryLazy(RTCPointQuery& query, int32_t idTMIntersected, ClosestPointQueryResult* pClosestPtResult);
+        // one round of candidate gathering of closestPointQueryLazy, the candidates are sorted from the nearest one
+        // returns false if the query has been given up (maxNumberOfBVHQuery, per round)
+        bool gatherClosestPointCandidates(RTCPointQuery& query, int32_t idTMIntersected, ClosestPointQueryResult* pClosestPtResult);
+        // the eager validation of a lazy query whose candidate gathering has been given up, as the BVH traversal of a round is
+        // wider than the eager one; with its own maxNumberOfBVHQuery
+        void closestPointQueryEagerFallback(RTCPointQuery& query, int32_t idTMIntersected, ClosestPointQueryResult* pClosestPtResult);
+        // wavefrontTraverse: closestPointQueryLazy of the numRecords records of the two phase batch query from firstRecord, their tet
+        // traversals interleaved by TetMeshFEM::tetrahedralTraverseWavefront
+        void closestPointQueryWavefront(BatchCollisionDetectionResult& results, int32_t firstRecord, int32_t numRecords,
+            bool computeClosestPointNormal);
+        // groupQueriesByEmbracingTet: closestPointQuery of the records of group iGroup of batchRecordGroupOffsets, a single BVH query
+        // around the centroid of their query points gathers the candidates of all of them; the records are queried on their own
+        // if it is given up (maxNumberOfBVHQuery) or if the group has a single record
+        void closestPointQueryGroup(BatchCollisionDetectionResult& results, int32_t iGroup, bool computeClosestPointNormal);
+        // the query point and the initial state of the closest point query of vertex vId of mesh tMeshId in tet idTetIntersected
+        void initClosestPointQuery(int32_t vId, int32_t tMeshId, int32_t idTMIntersected, int32_t idTetIntersected,
+            RTCPointQuery& query, ClosestPointQueryResult* pClosestPtResult);
+        void batchQueryToVertex(const BatchCollisionDetectionResult& results, int32_t iQuery, int32_t& meshId, int32_t& vId);
+        void writeClosestPointRecord(CollisionRecordArrays& records, size_t iRecord, ClosestPointQueryResult& closestPtResult,
+            bool computeNormal);
+
+        // greedily grows clusters of up to SURFACE_FACE_CLUSTER_SIZE faces by breadth first search over the face adjacency
+        void buildSurfaceFaceClusters(int32_t meshId, SurfaceFaceClusters& clusters);
+        // recomputes the normal cones of surfaceFaceClusters[meshId] from the current vertex positions
+        void updateSurfaceFaceClusterNormalCones(int32_t meshId);
 
         // edgeID: 0,1,2 represents 
         bool checkFeasibleRegion(embree::Vec3fa& p, TetMeshFEM *pTM, int32_t faceId, 
             ClosestPointOnTriangleType pointType, float feasibleREgionEpsilon);
+        // same as checkFeasibleRegion, but reads the half spaces of feasibleRegionTables[meshId]
+        bool checkFeasibleRegionFromTable(const embree::Vec3fa& p, int32_t meshId, int32_t faceId, ClosestPointOnTriangleType pointType);
+        // recomputes the half spaces of feasibleRegionTables[meshId] from the current vertex positions
+        void updateFeasibleRegionTable(int32_t meshId);
 
 		RTCScene tetMeshesScene;
 		int numTetsTotal;
@@ -74,16 +371,43 @@ namespace SP {
 		// a scene for each surface mesh
         // used for geodesic closest surface point query 
 		std::vector<RTCScene> surfaceMeshScenes;
+        // only used with leafBatchedClosestPoint, a cluster set for each surface mesh
+        std::vector<SurfaceFaceClusters> surfaceFaceClusters;
+        // only used with warmStartEmbracingTets, a cache for each vertex of each mesh
+        std::vector<std::vector<EmbracingTetCache>> embracingTetCaches;
+        // only used with cacheTraversalVerdicts, a cache for each mesh, cleared by updateBVH
+        std::vector<TraversalVerdictCache> traversalVerdictCaches;
+        // only used with warmStartClosestPointRadius, for each mesh the embracing tet (high 32 bits) and the closest face (low 32 bits)
+        // found at the last step for each of its vertices in each mesh (vId * numMeshes + intersected mesh id), -1 if not found
+        // atomic since the intersections of a vertex may be queried concurrently by the two phase batch query
+        std::vector<std::vector<std::atomic<int64_t>>> closestFaceCaches;
+        // only used with useFeasibleRegionTable, a table for each surface mesh
+        std::vector<FeasibleRegionTable> feasibleRegionTables;
 		
         void computeNormal(CollisionDetectionResult& colResult, int32_t iIntersection, std::array<float, 3>& normal);
+        void computeNormal(int32_t intersectedTMeshId, int32_t closestFaceId, ClosestPointOnTriangleType pointType,
+            std::array<float, 3>& normal);
 
 		RTCDevice device;
 
+        tbb::enumerable_thread_specific<BatchThreadLocalData> batchThreadLocalData;
+        // number of embracing tets of each query vertex of the batch query
+        std::vector<int32_t> batchQueryPenetrationCounts;
+        // two phase pipeline: query index of each compacted (vertex, embracing tet) pair
+        std::vector<int32_t> batchRecordQueryIds;
+        // groupQueriesByEmbracingTet: (global embracing tet id << 32 | record id) of each record, radix sorted, and its sort buffer
+        std::vector<uint64_t> batchRecordSortKeys;
+        std::vector<uint64_t> batchRecordSortBuffer;
+        // groupQueriesByEmbracingTet: start of each group of records sharing an embracing tet in batchRecordSortKeys, plus the end
+        std::vector<int32_t> batchRecordGroupOffsets;
+
 		const CollisionDetectionParamters& params;
 
 	};
 
+    // from the aligned vertex storage if enabled
     embree::Vec3fa loadVertexPos(TetMeshFEM* pTM, int32_t vId);
+    embree::Vec3fa loadRestposeVertexPos(TetMeshFEM* pTM, int32_t vId);
     embree::Vec3fa faceNormal(TetMeshFEM* pTM, int32_t faceId);
 
     // edgeID: 0,1,2 represents AB, BC, CA respectively
@@ -35,6 +35,8 @@ namespace SP {
 		FloatingType noGravZoneThreshold = 0;
 		FloatingType maxVelocityMagnitude = -1;
 		bool shuffleParallelizationGroup = false;
+		// TetMeshFEM::initialize renumbers the mesh along a Morton curve, the ids of this file stay the original ids
+		bool reorderForLocality = false;
 
 		std::string tetsColoringCategoriesPath;
 
@@ -62,6 +64,7 @@ namespace SP {
 		EXTRACT_FROM_JSON(objectParam, path);
 		EXTRACT_FROM_JSON(objectParam, tetsColoringCategoriesPath);
 		EXTRACT_FROM_JSON(objectParam, shuffleParallelizationGroup);
+		EXTRACT_FROM_JSON(objectParam, reorderForLocality);
 		return true;
 	}
 
@@ -81,6 +84,7 @@ namespace SP {
 		PUT_TO_JSON(objectParam, path);
 		PUT_TO_JSON(objectParam, tetsColoringCategoriesPath);
 		PUT_TO_JSON(objectParam, shuffleParallelizationGroup);
+		PUT_TO_JSON(objectParam, reorderForLocality);
 
 		return true;
 	}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "../common/math/vec2.h"
+#include "../common/math/vec3.h"
+
+namespace SP {
+#if defined(__AVX__)
+	constexpr int TET_TRAVERSE_PACKET_WIDTH = 8;
+#else
+	constexpr int TET_TRAVERSE_PACKET_WIDTH = 4;
+#endif
+
+	// the ray-aligned 2D coordinate systems of a packet of N rays, one ray per lane
+	template<int N>
+	struct RayFrameN
+	{
+		embree::Vec3<embree::vfloat<N>> origin;
+		// the 2 axes orthogonal to the ray direction
+		embree::Vec3<embree::vfloat<N>> axis0;
+		embree::Vec3<embree::vfloat<N>> axis1;
+	};
+
+	// the tets traversed by a packet of N rays, one tet per lane, their 4 vertices ordered as TetProjection4:
+	// the 3 vertices of the incoming face as tet4Faces[incomingFaceId], then the vertex across it
+	template<int N>
+	struct TetProjectionN
+	{
+		embree::Vec3<embree::vfloat<N>> pos[4];
+		// coordinates in the ray-aligned 2D coordinate system of the ray of each lane
+		embree::vfloat<N> u[4];
+		embree::vfloat<N> v[4];
+	};
+
+	// pos must be set, the operations are ordered as the scalar projection, thus the results are the same
+	template<int N>
+	inline void projectTetsToRayFramesN(const RayFrameN<N>& frame, TetProjectionN<N>& proj)
+	{
+		for (int iV = 0; iV < 4; iV++)
+		{
+			const embree::Vec3<embree::vfloat<N>> d = proj.pos[iV] - frame.origin;
+			proj.u[iV] = frame.axis0.x * d.x + frame.axis0.y * d.y + frame.axis0.z * d.z;
+			proj.v[iV] = frame.axis1.x * d.x + frame.axis1.y * d.y + frame.axis1.z * d.z;
+		}
+	}
+
+	// vectorized TetMeshFEM::exitFaceSelection of N tets: bit iLane of exitFaceMasks[i] is set if face i (the face across
+	// vertex i, i < 3) of the tet of lane iLane may be crossed by its ray
+	template<int N>
+	inline void exitFaceMasksN(const TetProjectionN<N>& proj, float rayTriIntersectionEpsilon, int exitFaceMasks[3])
+	{
+		typedef embree::vfloat<N> vfloatN;
+
+		const vfloatN du1 = proj.u[1] - proj.u[0], dv1 = proj.v[1] - proj.v[0];
+		const vfloatN du2 = proj.u[2] - proj.u[0], dv2 = proj.v[2] - proj.v[0];
+		const vfloatN incomingAreaSign = embree::signmsk(du1 * dv2 - dv1 * du2);
+
+		// the 2D cross product of vertex 3 and vertex i, oriented by the incoming face
+		vfloatN orientedDet[3];
+		for (int iV = 0; iV < 3; iV++)
+		{
+			orientedDet[iV] = (proj.u[3] * proj.v[iV] - proj.v[3] * proj.u[iV]) ^ incomingAreaSign;
+		}
+
+		// face i is bounded by the edges from vertex 3 to vertex (i + 1) % 3 and to vertex (i + 2) % 3
+		for (int iF = 0; iF < 3; iF++)
+		{
+			exitFaceMasks[iF] = int(embree::movemask((orientedDet[(iF + 1) % 3] >= vfloatN(-rayTriIntersectionEpsilon))
+				& (orientedDet[(iF + 2) % 3] <= vfloatN(rayTriIntersectionEpsilon))));
+		}
+	}
+
+	// the squared distance from the origin of the ray of each lane to the intersection of the ray and the exit face
+	// exitFaces (0~2, as float) of its tet, computed in the same way as the scalar pass through check
+	template<int N>
+	inline embree::vfloat<N> exitFaceIntersectionDistances2N(const RayFrameN<N>& frame, const TetProjectionN<N>& proj,
+		const embree::vfloat<N>& exitFaces)
+	{
+		typedef embree::vfloat<N> vfloatN;
+		typedef embree::Vec3<embree::vfloat<N>> Vec3vfN;
+
+		// the face vertices are ordered as TetMeshFEM::posibleExit3Faces[exitFace]
+		const embree::vboolf<N> aIsP1 = exitFaces == vfloatN(0.f);
+		const embree::vboolf<N> bIsP1 = exitFaces == vfloatN(2.f);
+		const vfloatN aU = select(aIsP1, proj.u[1], proj.u[0]), aV = select(aIsP1, proj.v[1], proj.v[0]);
+		const vfloatN bU = select(bIsP1, proj.u[1], proj.u[2]), bV = select(bIsP1, proj.v[1], proj.v[2]);
+		const vfloatN cU = proj.u[3], cV = proj.v[3];
+
+		// barycentrics of the 2D origin in the projected face
+		const vfloatN v0U = bU - aU, v0V = bV - aV;
+		const vfloatN v1U = cU - aU, v1V = cV - aV;
+		const vfloatN v2U = -aU, v2V = -aV;
+		const vfloatN den = v0U * v1V - v1U * v0V;
+		const vfloatN bary1 = (v2U * v1V - v1U * v2V) / den;
+		const vfloatN bary2 = (v0U * v2V - v2U * v0V) / den;
+		const vfloatN bary0 = vfloatN(1.0f) - bary1 - bary2;
+
+		const Vec3vfN a = select(aIsP1, proj.pos[1], proj.pos[0]);
+		const Vec3vfN b = select(bIsP1, proj.pos[1], proj.pos[2]);
+
+		const Vec3vfN d = bary0 * a + bary1 * b + bary2 * proj.pos[3] - frame.origin;
+		return d.x * d.x + d.y * d.y + d.z * d.z;
+	}
+}
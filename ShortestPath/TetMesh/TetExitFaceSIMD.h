@@ -0,0 +1,107 @@
+#pragma once
+
+#include "../common/math/vec2.h"
+#include "../common/math/vec3.h"
+
+namespace SP {
+	typedef embree::Vec3<embree::vfloat4> Vec3vf4;
+
+	// the ray-aligned 2D coordinate system of the tetrahedral traverse, broadcast to all the lanes
+	struct RayFrame4
+	{
+		Vec3vf4 origin;
+		// the 2 axes orthogonal to the ray direction
+		Vec3vf4 axis0;
+		Vec3vf4 axis1;
+	};
+
+	// the 4 vertices of the tet being traversed, one per lane, ordered as TetMeshFEM::projectTo2DCoordinates:
+	// the 3 vertices of the incoming face as tet4Faces[incomingFaceId], then the vertex across it
+	struct TetProjection4
+	{
+		Vec3vf4 pos;
+		// coordinates in the ray-aligned 2D coordinate system
+		embree::vfloat4 u;
+		embree::vfloat4 v;
+	};
+
+	inline void setRayFrame4(RayFrame4& frame, const float* origin, const float* axis0, const float* axis1)
+	{
+		frame.origin = Vec3vf4(embree::vfloat4(origin[0]), embree::vfloat4(origin[1]), embree::vfloat4(origin[2]));
+		frame.axis0 = Vec3vf4(embree::vfloat4(axis0[0]), embree::vfloat4(axis0[1]), embree::vfloat4(axis0[2]));
+		frame.axis1 = Vec3vf4(embree::vfloat4(axis1[0]), embree::vfloat4(axis1[1]), embree::vfloat4(axis1[2]));
+	}
+
+	// p0 ~ p3 are the xyz_ vertices in the order of TetProjection4
+	// the operations are ordered as the scalar projection, thus the results are the same
+	inline void projectTetToRayFrame4(const RayFrame4& frame, const embree::vfloat4& p0, const embree::vfloat4& p1,
+		const embree::vfloat4& p2, const embree::vfloat4& p3, TetProjection4& proj)
+	{
+		embree::transpose(p0, p1, p2, p3, proj.pos.x, proj.pos.y, proj.pos.z);
+		const Vec3vf4 d = proj.pos - frame.origin;
+		proj.u = frame.axis0.x * d.x + frame.axis0.y * d.y + frame.axis0.z * d.z;
+		proj.v = frame.axis1.x * d.x + frame.axis1.y * d.y + frame.axis1.z * d.z;
+	}
+
+	// vectorized TetMeshFEM::exitFaceSelection: bit i is set if face i of the projected vertices (the face across vertex i, i < 3)
+	// may be crossed by the ray, i.e. the origin of the 2D coordinate system is inside its projection up to rayTriIntersectionEpsilon
+	inline int exitFaceMask4(const TetProjection4& proj, float rayTriIntersectionEpsilon)
+	{
+		// lane 1: the signed area of the incoming face
+		const embree::vfloat4 du = proj.u - embree::shuffle<0>(proj.u);
+		const embree::vfloat4 dv = proj.v - embree::shuffle<0>(proj.v);
+		const embree::vfloat4 incomingArea = du * embree::shuffle<2>(dv) - dv * embree::shuffle<2>(du);
+
+		// lane i: the 2D cross product of vertex 3 and vertex i, oriented by the incoming face
+		const embree::vfloat4 det = embree::shuffle<3>(proj.u) * proj.v - embree::shuffle<3>(proj.v) * proj.u;
+		const embree::vfloat4 orientedDet = det ^ embree::signmsk(embree::shuffle<1>(incomingArea));
+
+		// face i is bounded by the edges from vertex 3 to vertex (i + 1) % 3 and to vertex (i + 2) % 3
+		const embree::vboolf4 crossed = (embree::shuffle<1, 2, 0, 3>(orientedDet) >= embree::vfloat4(-rayTriIntersectionEpsilon))
+			& (embree::shuffle<2, 0, 1, 3>(orientedDet) <= embree::vfloat4(rayTriIntersectionEpsilon));
+		return embree::movemask(crossed) & 0x7;
+	}
+
+	// lane i (i < 3): the barycentrics of the 2D origin in the projected face across vertex i, whose vertices are ordered as
+	// TetMeshFEM::posibleExit3Faces[i]
+	inline void exitFaceOriginBarycentrics(const TetProjection4& proj, embree::vfloat4& bary0, embree::vfloat4& bary1,
+		embree::vfloat4& bary2)
+	{
+		const embree::vfloat4 aU = embree::shuffle<1, 0, 0, 0>(proj.u), aV = embree::shuffle<1, 0, 0, 0>(proj.v);
+		const embree::vfloat4 bU = embree::shuffle<2, 2, 1, 1>(proj.u), bV = embree::shuffle<2, 2, 1, 1>(proj.v);
+		const embree::vfloat4 cU = embree::shuffle<3>(proj.u), cV = embree::shuffle<3>(proj.v);
+
+		const embree::vfloat4 v0U = bU - aU, v0V = bV - aV;
+		const embree::vfloat4 v1U = cU - aU, v1V = cV - aV;
+		const embree::vfloat4 v2U = -aU, v2V = -aV;
+		const embree::vfloat4 den = v0U * v1V - v1U * v0V;
+		bary1 = (v2U * v1V - v1U * v2V) / den;
+		bary2 = (v0U * v2V - v2U * v0V) / den;
+		bary0 = embree::vfloat4(1.0f) - bary1 - bary2;
+	}
+
+	// lane i (i < 3): the squared distance from the ray origin to the intersection of the ray and the face across vertex i,
+	// the face vertices are ordered as TetMeshFEM::posibleExit3Faces[i], in the same way as the scalar pass through check
+	inline embree::vfloat4 exitFaceIntersectionDistances2(const RayFrame4& frame, const TetProjection4& proj)
+	{
+		embree::vfloat4 bary0, bary1, bary2;
+		exitFaceOriginBarycentrics(proj, bary0, bary1, bary2);
+
+		const Vec3vf4 a(embree::shuffle<1, 0, 0, 0>(proj.pos.x), embree::shuffle<1, 0, 0, 0>(proj.pos.y),
+			embree::shuffle<1, 0, 0, 0>(proj.pos.z));
+		const Vec3vf4 b(embree::shuffle<2, 2, 1, 1>(proj.pos.x), embree::shuffle<2, 2, 1, 1>(proj.pos.y),
+			embree::shuffle<2, 2, 1, 1>(proj.pos.z));
+		const Vec3vf4 c(embree::shuffle<3>(proj.pos.x), embree::shuffle<3>(proj.pos.y), embree::shuffle<3>(proj.pos.z));
+
+		const Vec3vf4 d = bary0 * a + bary1 * b + bary2 * c - frame.origin;
+		return d.x * d.x + d.y * d.y + d.z * d.z;
+	}
+
+	// lane i (i < 3): the barycentric margin of the face across vertex i, same as TetMeshFEM::exitFaceBarycentricMargin
+	inline embree::vfloat4 exitFaceBarycentricMargins4(const TetProjection4& proj)
+	{
+		embree::vfloat4 bary0, bary1, bary2;
+		exitFaceOriginBarycentrics(proj, bary0, bary1, bary2);
+		return embree::min(embree::min(bary0, bary1), bary2);
+	}
+}
@@ -1,5 +1,7 @@
 #include "TetMeshFEM.h"
 #include "../Parallelization/CPUParallelization.h"
+#include "../common/math/vec2.h"
+#include "../common/math/vec3.h"
 
 #include <MeshFrame/Utility/IO.h>
 #include <random>
@@ -9,13 +11,6 @@ using namespace SP;
 #include <MeshFrame/Memory/Array.h>
 #include <unordered_set>
 
-#define SIZE_CANDIDATE_FACE_STACK 32
-#define SIZE_TRAVERSED_LIST_STACK 128
-#define SIZE_TRAVERSED_CIRCULAR_ARRAY 32
-// #define TRAVERESED_TETS_SET
-#define TRAVERESED_TETS_CIRCULAR_ARRAY
-//#define ONLY_RECORD_BRANCHING_TETS
-
 
 //Vec3& SP::TetMesh::getV(int vId)
 //{
@@ -125,6 +120,33 @@ void SP::TetMeshFEM::initialize(ObjectParams::SharedPtr inObjectParams, std::sha
 		}
 	}
 
+	// - the face shared with each neighbor tet is the one opposite to the vertex of the neighbor not in this tet
+	tetsNeighborFaceIds.resize(numTets());
+	for (int iTet = 0; iTet < numTets(); iTet++)
+	{
+		uint8_t neighborFaceIds = 0;
+		for (int iF = 0; iF < 4; iF++)
+		{
+			int32_t neiTetId = tetsNeighborTets(iF, iTet);
+			if (neiTetId == -1)
+			{
+				continue;
+			}
+			int32_t oppositeVId = tetsXorSums(neiTetId) ^ tetsXorSums(iTet) ^ mTetVIds(iF, iTet);
+			int32_t neiFaceId = 3;
+			for (int iV = 0; iV < 3; iV++)
+			{
+				if (oppositeVId == mTetVIds(iV, neiTetId)) {
+					neiFaceId = iV;
+					break;
+				}
+			}
+			neighborFaceIds |= neiFaceId << (2 * iF);
+		}
+		tetsNeighborFaceIds(iTet) = neighborFaceIds;
+	}
+	buildTetTopologyRecords();
+
 
 	//TBB_PARALLEL_FOR(0, mTetVIds.cols(), iTet, );
 	for (int iTet = 0; iTet < mTetVIds.cols(); ++iTet)
@@ -293,181 +315,456 @@ void SP::TetMeshFEM::initialize(ObjectParams::SharedPtr inObjectParams, std::sha
 		fixedMask(pObjectParams->fixedPoints[iV]) = true;
 	}
 
+	if (pObjectParams->reorderForLocality)
+	{
+		reorderForLocality();
+	}
+
 }
 
-size_t SP::TetMeshFEM::numVertices()
+void SP::TetMeshFEM::buildTetTopologyRecords()
 {
-	return m_nVertices;
+	tetTopologyRecords.resize(numTets());
+	for (int iTet = 0; iTet < numTets(); iTet++)
+	{
+		TetTopologyRecord& record = tetTopologyRecords[iTet];
+		for (int i = 0; i < 4; i++)
+		{
+			record.vIds[i] = mTetVIds(i, iTet);
+			int32_t neiTetId = tetsNeighborTets(i, iTet);
+			record.neighbors[i] = neiTetId == -1 ? -1 : (neiTetId << 2) | ((tetsNeighborFaceIds(iTet) >> (2 * i)) & 3);
+		}
+	}
 }
 
-size_t SP::TetMeshFEM::numTets()
+// spreads the 10 lowest bits of x to every third bit
+inline uint32_t mortonExpandBits(uint32_t x)
 {
-	return m_nTets;
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
 }
 
+// the order of the points (3 x N) along the Morton curve of their bounding box, ties are broken by index
+void mortonOrder(const TVerticesMat& points, VecDynamicI& order)
+{
+	Vec3 lower = points.rowwise().minCoeff();
+	Vec3 extent = points.rowwise().maxCoeff() - lower;
+	std::vector<std::pair<uint32_t, int32_t>> codes(points.cols());
+	for (int32_t i = 0; i < points.cols(); i++)
+	{
+		uint32_t code = 0;
+		for (int iDim = 0; iDim < 3; iDim++)
+		{
+			FloatingType normalized = extent(iDim) > 0.f ? (points(iDim, i) - lower(iDim)) / extent(iDim) : 0.f;
+			uint32_t quantized = std::min(uint32_t(normalized * 1024.f), 1023u);
+			code |= mortonExpandBits(quantized) << (2 - iDim);
+		}
+		codes[i] = { code, i };
+	}
+	std::sort(codes.begin(), codes.end());
 
+	order.resize(points.cols());
+	for (int32_t i = 0; i < points.cols(); i++)
+	{
+		order(i) = codes[i].second;
+	}
+}
 
-bool TetMeshFEM::tetrahedralTraverseTo(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId,
-	int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics)
+// new element i is the old element newToOld(i); only the first newToOld.size() columns are permuted
+template<typename Derived>
+void permuteCols(Eigen::DenseBase<Derived>& m, const VecDynamicI& newToOld)
 {
-	statistics.stopReason = TraverseStopReason::querySuccess;
+	auto original = m.eval();
+	for (int32_t i = 0; i < newToOld.size(); i++)
+	{
+		m.col(i) = original.col(newToOld(i));
+	}
+}
 
-	if (startTetId == targetTetId)
+template<typename Derived>
+void permuteEntries(Eigen::DenseBase<Derived>& v, const VecDynamicI& newToOld)
+{
+	auto original = v.eval();
+	for (int32_t i = 0; i < newToOld.size(); i++)
 	{
-		return true;
+		v(i) = original(newToOld(i));
 	}
-	// get the ray-aligned 2D coordinate system
-	Eigen::Matrix<FloatingType, 3, 2> axes;
-	CuMatrix::buildOrthonormalBasis(rayDir.data(), axes.col(0).data(), axes.col(1).data());
-	
-	assert(axes.col(0).dot(axes.col(1)) < 1e-6);
-	assert(axes.col(0).dot(rayDir) < 1e-6);
-	assert(axes.col(1).dot(rayDir) < 1e-6);
+}
 
-	Eigen::Matrix<FloatingType, 2, 3> axesT = axes.transpose();
+// replaces each id by oldToNew(id), -1 is kept
+template<typename Derived>
+void remapIds(Eigen::DenseBase<Derived>& ids, const VecDynamicI& oldToNew)
+{
+	for (int32_t i = 0; i < ids.size(); i++)
+	{
+		if (ids(i) != -1)
+		{
+			ids(i) = oldToNew(ids(i));
+		}
+	}
+}
 
-	// initialize the 2D coordinate
+void remapIds(std::vector<std::vector<IdType>>& ids, const VecDynamicI& oldToNew)
+{
+	for (std::vector<IdType>& list : ids)
+	{
+		for (IdType& id : list)
+		{
+			id = oldToNew(id);
+		}
+	}
+}
 
-	Eigen::Matrix<FloatingType, 2, 4> ptsProj2D;
+void invertPermutation(const VecDynamicI& permutation, VecDynamicI& inverse)
+{
+	inverse.resize(permutation.size());
+	for (int32_t i = 0; i < permutation.size(); i++)
+	{
+		inverse(permutation(i)) = i;
+	}
+}
 
-	int count = 0;
-	// rearrange the ording of vertices thus the vertex across the incoming face is the last one
-	// and the first 3 vertices are ordered as tet4Faces[startFaceId]
-	projectTo2DCoordinates(ptsProj2D, startTetId, startFaceId, axesT, rayOrigin);
+void SP::TetMeshFEM::reorderForLocality()
+{
+	int32_t nV = numVertices();
+	int32_t nT = numTets();
+	int32_t nF = numSurfaceFaces();
 
-	Eigen::Vector4i possibleExitFace;
-	exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
+	// vertices by their position, tets and surface faces by their centroid
+	mortonOrder(mVertPos.leftCols(nV), vertexOriginalIds);
 
-	// figure out the outcoming Face
-	CPArrayStatic<int32_t, SIZE_CANDIDATE_FACE_STACK> candidateExitFaces;
-	CPArrayStatic<int32_t, SIZE_CANDIDATE_FACE_STACK> candidateExitFacesCorrespondingTets;
+	TVerticesMat centroids(3, nT);
+	for (int32_t iTet = 0; iTet < nT; iTet++)
+	{
+		centroids.col(iTet) = 0.25f * (mVertPos.col(mTetVIds(0, iTet)) + mVertPos.col(mTetVIds(1, iTet))
+			+ mVertPos.col(mTetVIds(2, iTet)) + mVertPos.col(mTetVIds(3, iTet)));
+	}
+	mortonOrder(centroids, tetOriginalIds);
 
-#if defined TRAVERESED_TETS_SET
-	std::unordered_set<int32_t> traversedTets;
-	traversedTets.insert(startTetId);
-#elif defined TRAVERESED_TETS_CIRCULAR_ARRAY
-	CircularArray<int32_t, SIZE_TRAVERSED_CIRCULAR_ARRAY> traversedTets;
-	traversedTets.push_back(startTetId);
-#else
-	CPArrayStatic<int32_t, SIZE_TRAVERSED_LIST_STACK> traversedTets;
-	traversedTets.push_back(startTetId);
-#endif
+	centroids.resize(3, nF);
+	for (int32_t iF = 0; iF < nF; iF++)
+	{
+		centroids.col(iF) = (mVertPos.col(surfaceFacesTetMeshVIds(0, iF)) + mVertPos.col(surfaceFacesTetMeshVIds(1, iF))
+			+ mVertPos.col(surfaceFacesTetMeshVIds(2, iF))) / 3.f;
+	}
+	mortonOrder(centroids, surfaceFaceOriginalIds);
 
-#ifdef OUTPUT_TRAVERSED_TETS 
-	statistics.traversedTetsOutput.clear();
-	statistics.traversedTetsOutput.push_back(startTetId);
-#endif
+	invertPermutation(vertexOriginalIds, vertexReorderedIds);
+	invertPermutation(tetOriginalIds, tetReorderedIds);
+	invertPermutation(surfaceFaceOriginalIds, surfaceFaceReorderedIds);
 
-	for (int i = 0; i < 3; i++)
+	// - per vertex arrays, the extra vertex at the end of the position buffers stays there
+	permuteCols(mVertPos, vertexOriginalIds);
+	permuteCols(mVertPrevPos, vertexOriginalIds);
+	permuteCols(mVelocity, vertexOriginalIds);
+#ifdef ENABLE_REST_POSE_CLOSEST_POINT
+	permuteCols(restposeVerts, vertexOriginalIds);
+#endif // ENABLE_REST_POSE_CLOSEST_POINT
+	permuteEntries(vertexMass, vertexOriginalIds);
+	permuteEntries(vertexInvMass, vertexOriginalIds);
+	permuteEntries(verticesInvertedSign, vertexOriginalIds);
+	permuteEntries(verticesInvertedSignPrevPos, vertexOriginalIds);
+	permuteEntries(verticesCollisionDetectionEnabled, vertexOriginalIds);
+	permuteEntries(tetVertIndicesToSurfaceVertIndices, vertexOriginalIds);
+	permuteEntries(fixedMask, vertexOriginalIds);
+
+	// - per tet arrays, the vertex order in each tet is kept, thus the local face ids are unchanged
+	permuteCols(mTetVIds, tetOriginalIds);
+	permuteCols(tetsNeighborTets, tetOriginalIds);
+	Eigen::Map<Eigen::Matrix<FloatingType, 9, Eigen::Dynamic>> DSInvsMat(DSInvs.data(), 9, nT);
+	permuteCols(DSInvsMat, tetOriginalIds);
+	permuteEntries(tetRestVolume, tetOriginalIds);
+	permuteEntries(tetInvRestVolume, tetOriginalIds);
+	permuteEntries(tetsInvertedSign, tetOriginalIds);
+	permuteEntries(tetsInvertedSignPrevPos, tetOriginalIds);
+	permuteEntries(tetsIsSurfaceTet, tetOriginalIds);
+	permuteEntries(tetsNeighborFaceIds, tetOriginalIds);
+#ifdef TET_TET_ADJACENT_LIST
+	std::vector<std::vector<IdType>> originalTetAllNeighborTets = tetAllNeighborTets;
+	for (int32_t iTet = 0; iTet < nT; iTet++)
 	{
-		if (possibleExitFace(i))
-		{
-			// the first 3 vertices are ordered as tet4Faces[startFaceId]
-			// thus tet4Faces[startFaceId][i] is the exit face id
-			int32_t exitFaceId = tet4Faces[startFaceId][i];
+		tetAllNeighborTets[iTet] = originalTetAllNeighborTets[tetOriginalIds(iTet)];
+	}
+	remapIds(tetAllNeighborTets, tetReorderedIds);
+#endif // TET_TET_ADJACENT_LIST
 
-			candidateExitFaces.push_back(exitFaceId);
-			candidateExitFacesCorrespondingTets.push_back(startTetId);
-		}
+	// - per surface face arrays
+	permuteCols(surfaceFacesTetMeshVIds, surfaceFaceOriginalIds);
+	permuteCols(surfaceFacesSurfaceMeshVIds, surfaceFaceOriginalIds);
+	permuteCols(surfaceFaces3NeighborFaces, surfaceFaceOriginalIds);
+	permuteEntries(surfaceFacesBelongingTets, surfaceFaceOriginalIds);
+	permuteEntries(surfaceFacesIdAtBelongingTets, surfaceFaceOriginalIds);
+
+	// - the ids stored in the arrays
+	remapIds(mTetVIds, vertexReorderedIds);
+	remapIds(surfaceVIds, vertexReorderedIds);
+	remapIds(surfaceFacesTetMeshVIds, vertexReorderedIds);
+	remapIds(surfaceVertexNeighborSurfaceVertices, vertexReorderedIds);
+	remapIds(tetsNeighborTets, tetReorderedIds);
+	remapIds(surfaceFacesBelongingTets, tetReorderedIds);
+	remapIds(tetsColoringCategories, tetReorderedIds);
+	remapIds(surfaceFaces3NeighborFaces, surfaceFaceReorderedIds);
+	remapIds(surfaceVertexNeighborSurfaceFaces, surfaceFaceReorderedIds);
+
+	for (int32_t iTet = 0; iTet < nT; iTet++)
+	{
+		tetsXorSums(iTet) = mTetVIds(0, iTet) ^ mTetVIds(1, iTet) ^ mTetVIds(2, iTet) ^ mTetVIds(3, iTet);
 	}
+	buildTetTopologyRecords();
+}
 
-	statistics.numTetsTraversed = 0;
-	while (!candidateExitFaces.empty())
+void SP::TetMeshFEM::getVerticesOriginalOrder(TVerticesMat& verts)
+{
+	verts.resize(3, numVertices());
+	for (int32_t vId = 0; vId < numVertices(); vId++)
 	{
-		int32_t intersectedFaceId = candidateExitFaces.pop_back();
-		int32_t previousTetId = candidateExitFacesCorrespondingTets.pop_back();
+		verts.col(originalVertexId(vId)) = mVertPos.col(vId);
+	}
+}
 
-		int32_t intersectedFaceVIds[3] = {
-			mTetVIds(tet4Faces[intersectedFaceId][0], previousTetId),
-			mTetVIds(tet4Faces[intersectedFaceId][1], previousTetId),
-			mTetVIds(tet4Faces[intersectedFaceId][2], previousTetId)
-		};
+void SP::TetMeshFEM::setVerticesOriginalOrder(const TVerticesMat& verts)
+{
+	for (int32_t vId = 0; vId < numVertices(); vId++)
+	{
+		mVertPos.col(vId) = verts.col(originalVertexId(vId));
+	}
+}
 
-		int32_t currentTetId = tetsNeighborTets(intersectedFaceId, previousTetId);
+void SP::TetMeshFEM::updateTetGeometryCache()
+{
+	tetFacePlanes.resize(16, numTets());
+	tetOrientedVolumes.resize(numTets());
 
-		//std::cout << "Previous tet VIds: " << mTetVIds.col(previousTetId).transpose() << std::endl;
+	auto computeTetGeometry = [&](int32_t tetId) {
+		int32_t* tetVIds = mTetVIds.col(tetId).data();
 
-#ifdef OUTPUT_TRAVERSED_TETS 
-		statistics.traversedTetsOutput.push_back(currentTetId);
-#endif
+		FloatingType tetOrientedVolume = CuMatrix::tetOrientedVolume(mVertPos.data(), tetVIds);
+		tetOrientedVolumes(tetId) = tetOrientedVolume;
+		// same criterion as CuMatrix::tetPointInTet: p is inside iff (p - v0).n_i * tetOrientedVolume < 0 for all the faces
+		FloatingType orientation = tetOrientedVolume > 0.f ? 1.f : (tetOrientedVolume < 0.f ? -1.f : 0.f);
 
-		if (currentTetId == targetTetId)
+		// the 4 faces are computed at once, lane iF is face tet4Faces[iF]
+		alignas(16) FloatingType faceVerts[3][3][4];
+		for (int iF = 0; iF < 4; iF++)
 		{
-			statistics.stopReason = TraverseStopReason::querySuccess;
-			return true;
+			for (int iFV = 0; iFV < 3; iFV++)
+			{
+				const FloatingType* v = mVertPos.col(tetVIds[tet4Faces[iF][iFV]]).data();
+				faceVerts[iFV][0][iF] = v[0];
+				faceVerts[iFV][1][iF] = v[1];
+				faceVerts[iFV][2][iF] = v[2];
+			}
 		}
 
-		if (currentTetId == -1)
-			// reached the boundary
+		typedef embree::Vec3<embree::vfloat4> Vec3vf4;
+		const Vec3vf4 v0(embree::vfloat4::load(faceVerts[0][0]), embree::vfloat4::load(faceVerts[0][1]), embree::vfloat4::load(faceVerts[0][2]));
+		const Vec3vf4 v1(embree::vfloat4::load(faceVerts[1][0]), embree::vfloat4::load(faceVerts[1][1]), embree::vfloat4::load(faceVerts[1][2]));
+		const Vec3vf4 v2(embree::vfloat4::load(faceVerts[2][0]), embree::vfloat4::load(faceVerts[2][1]), embree::vfloat4::load(faceVerts[2][2]));
+
+		const Vec3vf4 normal = embree::vfloat4(orientation) * embree::cross(v1 - v0, v2 - v1);
+		const embree::vfloat4 offset = -embree::dot(normal, v0);
+
+		FloatingType* planes = tetFacePlanes.col(tetId).data();
+		embree::vfloat4::store(planes, normal.x);
+		embree::vfloat4::store(planes + 4, normal.y);
+		embree::vfloat4::store(planes + 8, normal.z);
+		embree::vfloat4::store(planes + 12, offset);
+	};
+	cpu_parallel_for(0, numTets(), computeTetGeometry);
+}
+
+void SP::TetMeshFEM::updateSurfaceNormalCache()
+{
+	surfaceFaceOrientedAreas.resize(3, numSurfaceFaces());
+	surfaceFaceNormals.resize(3, numSurfaceFaces());
+	surfaceFaceEdgeNormals.resize(9, numSurfaceFaces());
+	surfaceVertexNormals.resize(3, numSurfaceVerts());
+
+	auto computeFaceNormals = [&](int32_t faceId) {
+		Vec3 orientedArea;
+		computeFaceOrientedVolume(faceId, orientedArea);
+		surfaceFaceOrientedAreas.col(faceId) = orientedArea;
+		surfaceFaceNormals.col(faceId) = orientedArea / orientedArea.norm();
+	};
+	cpu_parallel_for(0, numSurfaceFaces(), computeFaceNormals);
+
+	auto computeEdgeNormals = [&](int32_t faceId) {
+		for (int32_t edgeId = 0; edgeId < 3; edgeId++)
 		{
-			statistics.stopReason = TraverseStopReason::reachedBoundary;
-			return false;
+			int32_t neiFaceId = surfaceFaces3NeighborFaces(edgeId, faceId);
+			Vec3 normal = surfaceFaceOrientedAreas.col(faceId) + surfaceFaceOrientedAreas.col(neiFaceId);
+			surfaceFaceEdgeNormals.block<3, 1>(3 * edgeId, faceId) = normal / normal.norm();
 		}
-#if defined TRAVERESED_TETS_SET
+	};
+	cpu_parallel_for(0, numSurfaceFaces(), computeEdgeNormals);
 
-		if (traversedTets.find(currentTetId) != traversedTets.end())
-			// formed loop, cut this branch here
+	auto computeVertexNormals = [&](int32_t surfaceVId) {
+		Vec3 normal = Vec3::Zero();
+		for (int iF = 0; iF < surfaceVertexNeighborSurfaceFaces[surfaceVId].size(); iF++)
 		{
-			continue;
+			normal += surfaceFaceOrientedAreas.col(surfaceVertexNeighborSurfaceFaces[surfaceVId][iF]);
 		}
-		else
+		surfaceVertexNormals.col(surfaceVId) = normal / normal.norm();
+	};
+	cpu_parallel_for(0, numSurfaceVerts(), computeVertexNormals);
+}
+
+void SP::TetMeshFEM::updateAlignedVertexStorage()
+{
+	alignedVertPos.resize(numVertices());
+	auto copyVertex = [&](int32_t vId) {
+		alignedVertPos[vId] = embree::Vec3fa(mVertPos(0, vId), mVertPos(1, vId), mVertPos(2, vId));
+	};
+	cpu_parallel_for(0, numVertices(), copyVertex);
+}
+
+void SP::TetMeshFEM::updateAlignedRestposeStorage()
+{
+	alignedRestposeVerts.resize(numVertices());
+	for (int32_t vId = 0; vId < numVertices(); vId++)
+	{
+		alignedRestposeVerts[vId] = embree::Vec3fa(restposeVerts(0, vId), restposeVerts(1, vId), restposeVerts(2, vId));
+	}
+}
+
+SP::TAlignedVerticesMap SP::TetMeshFEM::alignedVertPosView()
+{
+	return TAlignedVerticesMap((float*)alignedVertPos.data(), POINT_VEC_DIMS, alignedVertPos.size(), Eigen::OuterStride<4>());
+}
+
+size_t SP::TetMeshFEM::numVertices()
+{
+	return m_nVertices;
+}
+
+size_t SP::TetMeshFEM::numTets()
+{
+	return m_nTets;
+}
+
+
+
+template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy, typename InstrumentationPolicy>
+bool TetMeshFEM::tetrahedralTraverse(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId,
+	int32_t startFaceId, int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics,
+	InstrumentationPolicy& instrumentation)
+{
+	VisitedPolicy traversedTets;
+	traversedTets.reset(numTets(), startTetId);
+	instrumentation.record(startTetId);
+
+	return tetrahedralTraverseFrom<StackPolicy, VisitedPolicy, ForwardCheckPolicy>(rayOrigin, rayDir, maxTraversalDis, startTetId,
+		startFaceId, true, targetTetId, rayTriIntersectionEpsilon, traversedTets, statistics, instrumentation);
+}
+
+template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy, typename InstrumentationPolicy>
+bool TetMeshFEM::tetrahedralTraverseFrom(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t tetId,
+	int32_t incomingFaceId, bool atStartTet, int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, VisitedPolicy& traversedTets,
+	TraverseStatistics& statistics, InstrumentationPolicy& instrumentation)
+{
+	statistics.stopReason = TraverseStopReason::querySuccess;
+
+	if (atStartTet && tetId == targetTetId)
+	{
+		return true;
+	}
+	// get the ray-aligned 2D coordinate system
+	Eigen::Matrix<FloatingType, 3, 2> axes;
+	CuMatrix::buildOrthonormalBasis(rayDir.data(), axes.col(0).data(), axes.col(1).data());
+	
+	assert(axes.col(0).dot(axes.col(1)) < 1e-6);
+	assert(axes.col(0).dot(rayDir) < 1e-6);
+	assert(axes.col(1).dot(rayDir) < 1e-6);
+
+	Eigen::Matrix<FloatingType, 2, 3> axesT = axes.transpose();
+
+	// initialize the 2D coordinate
+	Eigen::Matrix<FloatingType, 2, 4> ptsProj2D;
+	// the same in SIMD registers, if simdExitFaceKernelEnabled
+	RayFrame4 rayFrame;
+	TetProjection4 tetProj;
+	alignas(16) float exitFaceDistances2[4];
+	// if pluckerTraverseEnabled
+	TetRayPlucker plucker;
+	if (simdExitFaceKernelEnabled)
+	{
+		setRayFrame4(rayFrame, rayOrigin.data(), axes.col(0).data(), axes.col(1).data());
+	}
+
+	Eigen::Vector4i possibleExitFace;
+
+	// if bestFirstBranchOrderEnabled, the barycentric margins of the possible exit faces of a tet where the ray branches
+	alignas(16) float exitFaceMargins[4];
+	TraverseBranchHeap branches;
+	auto computeExitFaceMargins = [&]() {
+		if (pluckerTraverseEnabled)
 		{
-			traversedTets.insert(currentTetId);
+			for (int iF = 0; iF < 3; iF++)
+			{
+				exitFaceMargins[iF] = possibleExitFace(iF) ? exitFaceBarycentricMarginPlucker(plucker, iF) : 0.f;
+			}
 		}
-#elif defined TRAVERESED_TETS_CIRCULAR_ARRAY
-		if (traversedTets.hasBackward(currentTetId))
+		else if (simdExitFaceKernelEnabled)
 		{
-			continue;
+			embree::vfloat4::store(exitFaceMargins, exitFaceBarycentricMargins4(tetProj));
 		}
-#ifndef ONLY_RECORD_BRANCHING_TETS
-		traversedTets.push_back(currentTetId);
-#endif // ONLY_RECORD_BRANCHING_TETS
+		else
+		{
+			for (int iF = 0; iF < 3; iF++)
+			{
+				exitFaceMargins[iF] = possibleExitFace(iF) ? exitFaceBarycentricMargin(ptsProj2D, iF) : 0.f;
+			}
+		}
+	};
 
-#else
-		if (traversedTets.has(currentTetId))
-			// formed loop, cut this branch here
+	// figure out the outcoming Face
+	StackPolicy candidateExitFaces;
+
+	// selects the exit faces of tet currentTetId, entered from its face incomingFaceIdCurTet, and pushes them to the candidate
+	// stack; returns 1 if the target is reached, 0 if the traversal is stopped and -1 if it goes on
+	auto traverseTet = [&](int32_t currentTetId, int32_t incomingFaceIdCurTet) {
+		// rearrange the ording of vertices thus the vertex across the incoming face (incomingFaceIdCurTet) is the last one
+		// and the first 3 vertices are ordered as tet4Faces[startFaceId]
+		int numIntersectingFaces;
+		if (pluckerTraverseEnabled)
 		{
-			continue;
+			computePluckerProducts(plucker, currentTetId, incomingFaceIdCurTet, rayOrigin, rayDir);
+			numIntersectingFaces = exitFaceSelectionPlucker(plucker, possibleExitFace, rayTriIntersectionEpsilon);
+		}
+		else if (simdExitFaceKernelEnabled)
+		{
+			projectTo2DCoordinatesSIMD(tetProj, currentTetId, incomingFaceIdCurTet, rayFrame);
+			numIntersectingFaces = exitFaceSelectionSIMD(tetProj, possibleExitFace, rayTriIntersectionEpsilon);
 		}
 		else
-			// add currentTetId to traversed tets list
 		{
-			if (!traversedTets.push_back(currentTetId)) {
-				stopReason = TraverseStopReason::overflow;
-				return false;
-			}
+			projectTo2DCoordinates(ptsProj2D, currentTetId, incomingFaceIdCurTet, axesT, rayOrigin);
+			numIntersectingFaces = exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
 		}
-#endif
-
-		int32_t newVertexId = tetsXorSums(currentTetId) 
-			^ intersectedFaceVIds[0]
-			^ intersectedFaceVIds[1]
-			^ intersectedFaceVIds[2];
-		
-		// the intersectedFaceId is not the incoming face id of intersectedFaceId
-		// we need to query the id of the incoming face
-		int32_t incomingFaceIdCurTet = 3;
-		for (int iV = 0; iV < 3; iV++)
+		if (ForwardCheckPolicy::enabled)
 		{
-			if (newVertexId == mTetVIds(iV, currentTetId)) {
-				incomingFaceIdCurTet = iV;
-
-				break;
-			}
+			numIntersectingFaces = checkExitFaceForward(rayDir, currentTetId, incomingFaceIdCurTet, possibleExitFace);
 		}
-		//std::cout << "Current tet VIds: " << mTetVIds.col(currentTetId).transpose() << std::endl;
+		traversedTets.onExitFaces(currentTetId, numIntersectingFaces);
 
-		// rearrange the ording of vertices thus the vertex across the incoming face (incomingFaceIdCurTet) is the last one
-		// and the first 3 vertices are ordered as tet4Faces[startFaceId]
-		projectTo2DCoordinates(ptsProj2D, currentTetId, incomingFaceIdCurTet, axesT, rayOrigin);
-		int numNumIntersectingFaces = exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
-#ifdef ONLY_RECORD_BRANCHING_TETS
-		if (numNumIntersectingFaces > 1)
+		// the ray parameters of the Plucker traverse are cheap, thus checked at each step
+		bool checkPassThrough = (pluckerTraverseEnabled || !(statistics.numTetsTraversed % passThroughCheckSteps)
+			|| (StackPolicy::earlyPassThroughCheck && statistics.numTetsTraversed == 2)) && maxTraversalDis > 0.f;
+		if (checkPassThrough && !pluckerTraverseEnabled && simdExitFaceKernelEnabled)
+			// of all the possible exit faces at once
 		{
-			traversedTets.push_back(currentTetId);
+			embree::vfloat4::store(exitFaceDistances2, exitFaceIntersectionDistances2(rayFrame, tetProj));
 		}
-#endif // ONLY_RECORD_BRANCHING_TETS
 
+		bool orderBranches = bestFirstBranchOrderEnabled && numIntersectingFaces > 1;
+		if (orderBranches)
+		{
+			computeExitFaceMargins();
+		}
 		for (int iF = 0; iF < 3; iF++)
 		{
 			if (possibleExitFace(iF))
@@ -476,144 +773,119 @@ bool TetMeshFEM::tetrahedralTraverseTo(const Vec3& rayOrigin, const Vec3& rayDir
 				// the exit face id is the actual vertex id (0~3), not how they are arranged in ptsProj2D
 				// exit face id can be deduced from tet4Faces[incomingFaceIdCurTet]
 				int32_t exitFaceId = tet4Faces[incomingFaceIdCurTet][iF];
-				int32_t nextTetId = tetsNeighborTets(exitFaceId, currentTetId);
+				int32_t nextTetId = tetNeighborTet(currentTetId, exitFaceId);
 				if (nextTetId == targetTetId)
 				{
 					statistics.stopReason = TraverseStopReason::querySuccess;
-					return true;
+					return 1;
 				}
 
-				if (!candidateExitFaces.push_back(exitFaceId) || !candidateExitFacesCorrespondingTets.push_back(currentTetId))
-					// the static array has overflown, static version of this function cannot be used
-					// in this case this function will return false and set stackOverflow=true, to notify the frame work to call a version with dynamic mem allocation
+				if (orderBranches)
 				{
-					statistics.stopReason = TraverseStopReason::overflow;
-					return false;
+					branches.push({ exitFaceId, currentTetId }, exitFaceMargins[iF]);
+				}
+				else
+				{
+					candidateExitFaces.push({ exitFaceId, currentTetId });
 				}
 
-				if ((!(statistics.numTetsTraversed % passThroughCheckSteps)) && maxTraversalDis > 0.f)
+				if (checkPassThrough)
 					// check pass through
 				{
-					Vec3 barys, intersectPt;
-
-
-					//std::cout << "ptsProj2D: \n" << ptsProj2D << std::endl;
-
-					originBarycentric2DTriangle(ptsProj2D.col(posibleExit3Faces[iF][0]),
-						ptsProj2D.col(posibleExit3Faces[iF][1]),
-						ptsProj2D.col(posibleExit3Faces[iF][2]),
-						barys);
-					intersectPt = Vec3::Zero();
-
-					//for (int iV = 0; iV < 3; iV++)
-					//{
-					//	intersectPt += barys(iV) * ptsPermuted3D.col(posibleExit3Faces[iF][iV]);
-					//}
-					Eigen::Matrix<FloatingType, 3, 4> ptsPermuted3D;
-					copyRepermutedVerts(ptsPermuted3D, currentTetId, incomingFaceIdCurTet);
-
-					intersectPt += barys(0) * ptsPermuted3D.col(posibleExit3Faces[iF][0])
-					            +  barys(1) * ptsPermuted3D.col(posibleExit3Faces[iF][1])
-					            +  barys(2) * ptsPermuted3D.col(posibleExit3Faces[iF][2]);
-
-					/*Vec2 sum = (ptsProj2D.col(posibleExit3Faces[iF][0]) * barys[0]
-						+ ptsProj2D.col(posibleExit3Faces[iF][1]) * barys[1]
-						+ ptsProj2D.col(posibleExit3Faces[iF][2]) * barys[2]);*/
-
-					// assert((ptsProj2D.col(posibleExit3Faces[iF][0]) * barys[0]
-					// 	+ ptsProj2D.col(posibleExit3Faces[iF][1]) * barys[1]
-					// 	+ ptsProj2D.col(posibleExit3Faces[iF][2]) * barys[2]).norm() < 1e-6);
-					// assert(barys[0] > -0.01 && barys[0] < 1.01);
-					// assert(barys[1] > -0.01 && barys[1] < 1.01);
-					// assert(barys[2] > -0.01 && barys[2] < 1.01 );
-					// assert((intersectPt - rayOrigin).cross(rayDir).norm() < 1e-5);
-					
-
-					if ( (intersectPt - rayOrigin).squaredNorm() > maxTraversalDis * maxTraversalDis)
+					FloatingType exitFaceDistance2;
+					if (pluckerTraverseEnabled)
+					{
+						FloatingType exitFaceRayParam = exitFaceRayParameter(plucker, iF);
+						exitFaceDistance2 = exitFaceRayParam * exitFaceRayParam;
+					}
+					else if (simdExitFaceKernelEnabled)
+					{
+						exitFaceDistance2 = exitFaceDistances2[iF];
+					}
+					else
+					{
+						exitFaceDistance2 = exitFaceIntersectionDistance2(ptsProj2D, currentTetId, incomingFaceIdCurTet, iF, rayOrigin);
+					}
+					if (exitFaceDistance2 > maxTraversalDis * maxTraversalDis)
 					{
 						statistics.stopReason = TraverseStopReason::passedMaximumDis;
-						// std::cout << "Traversed distance: " << (intersectPt - rayOrigin).norm() 
-						// 	<<" has passed through maximum traverse dis: " << maxTraversalDis
-						// 	<<" at step " << steps << " | traversed set size:" <<  traversedTets.size() << "!\n";
-						return false;
+						return 0;
 					}
 				}
 			}
 		}
+		while (!branches.empty())
+		{
+			candidateExitFaces.push(branches.pop());
+		}
 		++statistics.numTetsTraversed;
+		return -1;
+	};
 
-	}
-	
-	statistics.stopReason = TraverseStopReason::emptyStack;
-	return false;
-}
-
-bool SP::TetMeshFEM::tetrahedralTraverseToLoopLess(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId,
-	int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics)
-{
-	statistics.stopReason = TraverseStopReason::querySuccess;
-	if (startTetId == targetTetId)
+	if (atStartTet)
 	{
-		return true;
-	}
-	// get the ray-aligned 2D coordinate system
-	Eigen::Matrix<FloatingType, 3, 2> axes;
-	CuMatrix::buildOrthonormalBasis(rayDir.data(), axes.col(0).data(), axes.col(1).data());
-
-	assert(axes.col(0).dot(axes.col(1)) < 1e-6);
-	assert(axes.col(0).dot(rayDir) < 1e-6);
-	assert(axes.col(1).dot(rayDir) < 1e-6);
-
-	Eigen::Matrix<FloatingType, 2, 3> axesT = axes.transpose();
-
-	// initialize the 2D coordinate
-	Eigen::Matrix<FloatingType, 2, 4> ptsProj2D;
-
-	// rearrange the ording of vertices thus the vertex across the incoming face is the last one
-	// and the first 3 vertices are ordered as tet4Faces[startFaceId]
-	projectTo2DCoordinates(ptsProj2D, startTetId, startFaceId, axesT, rayOrigin);
-
-	Eigen::Vector4i possibleExitFace;
-	exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
-
-	// figure out the outcoming Face
-	std::vector<int32_t> candidateExitFaces;
-	std::vector<int32_t> candidateExitFacesCorrespondingTets;
-
-	candidateExitFaces.reserve(SIZE_CANDIDATE_FACE_STACK * 2);
-	candidateExitFacesCorrespondingTets.reserve(SIZE_CANDIDATE_FACE_STACK * 2);
-
+		// rearrange the ording of vertices thus the vertex across the incoming face is the last one
+		// and the first 3 vertices are ordered as tet4Faces[startFaceId]
+		int numStartExitFaces;
+		if (pluckerTraverseEnabled)
+		{
+			computePluckerProducts(plucker, tetId, incomingFaceId, rayOrigin, rayDir);
+			numStartExitFaces = exitFaceSelectionPlucker(plucker, possibleExitFace, rayTriIntersectionEpsilon);
+		}
+		else if (simdExitFaceKernelEnabled)
+		{
+			projectTo2DCoordinatesSIMD(tetProj, tetId, incomingFaceId, rayFrame);
+			numStartExitFaces = exitFaceSelectionSIMD(tetProj, possibleExitFace, rayTriIntersectionEpsilon);
+		}
+		else
+		{
+			projectTo2DCoordinates(ptsProj2D, tetId, incomingFaceId, axesT, rayOrigin);
+			numStartExitFaces = exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
+		}
 
-	for (size_t i = 0; i < 3; i++)
+		bool orderBranches = bestFirstBranchOrderEnabled && numStartExitFaces > 1;
+		if (orderBranches)
+		{
+			computeExitFaceMargins();
+		}
+		for (int i = 0; i < 3; i++)
+		{
+			if (possibleExitFace(i))
+			{
+				// the first 3 vertices are ordered as tet4Faces[startFaceId]
+				// thus tet4Faces[startFaceId][i] is the exit face id
+				if (orderBranches)
+				{
+					branches.push({ tet4Faces[incomingFaceId][i], tetId }, exitFaceMargins[i]);
+				}
+				else
+				{
+					candidateExitFaces.push({ tet4Faces[incomingFaceId][i], tetId });
+				}
+			}
+		}
+		while (!branches.empty())
+		{
+			candidateExitFaces.push(branches.pop());
+		}
+	}
+	else
 	{
-		if (possibleExitFace(i))
+		int verdict = traverseTet(tetId, incomingFaceId);
+		if (verdict != -1)
 		{
-			// the first 3 vertices are ordered as tet4Faces[startFaceId]
-			// thus tet4Faces[startFaceId][i] is the exit face id
-			int32_t exitFaceId = tet4Faces[startFaceId][i];
-
-			candidateExitFaces.push_back(exitFaceId);
-			candidateExitFacesCorrespondingTets.push_back(startTetId);
+			return verdict == 1;
 		}
 	}
 
-	statistics.numTetsTraversed = 0;
 	while (!candidateExitFaces.empty())
 	{
-		int32_t intersectedFaceId = candidateExitFaces.back();
-		candidateExitFaces.pop_back();
-		int32_t previousTetId = candidateExitFacesCorrespondingTets.back();
-		candidateExitFacesCorrespondingTets.pop_back();
-
-		int32_t intersectedFaceVIds[3] = {
-			mTetVIds(tet4Faces[intersectedFaceId][0], previousTetId),
-			mTetVIds(tet4Faces[intersectedFaceId][1], previousTetId),
-			mTetVIds(tet4Faces[intersectedFaceId][2], previousTetId)
-		};
+		TraverseCandidate candidate = candidateExitFaces.pop();
+		int32_t intersectedFaceId = candidate.exitFaceId;
+		int32_t previousTetId = candidate.tetId;
 
-		int32_t currentTetId = tetsNeighborTets(intersectedFaceId, previousTetId);
-
-		//std::cout << "Previous tet VIds: " << mTetVIds.col(previousTetId).transpose() << std::endl;
+		int32_t currentTetId = tetNeighborTet(previousTetId, intersectedFaceId);
+		instrumentation.record(currentTetId);
 
 		if (currentTetId == targetTetId)
 		{
@@ -628,314 +900,511 @@ bool SP::TetMeshFEM::tetrahedralTraverseToLoopLess(const Vec3& rayOrigin, const
 			return false;
 		}
 
-
-		int32_t newVertexId = tetsXorSums(currentTetId)
-			^ intersectedFaceVIds[0]
-			^ intersectedFaceVIds[1]
-			^ intersectedFaceVIds[2];
+		if (!traversedTets.visit(currentTetId))
+			// formed loop, cut this branch here
+		{
+			continue;
+		}
 
 		// the intersectedFaceId is not the incoming face id of intersectedFaceId
-		// we need to query the id of the incoming face
-		int32_t incomingFaceIdCurTet = 3;
-		for (size_t iV = 0; iV < 3; iV++)
+		int32_t incomingFaceIdCurTet = tetNeighborFaceId(previousTetId, intersectedFaceId);
+
+		int verdict = traverseTet(currentTetId, incomingFaceIdCurTet);
+		if (verdict != -1)
 		{
-			if (newVertexId == mTetVIds(iV, currentTetId)) {
-				incomingFaceIdCurTet = iV;
+			return verdict == 1;
+		}
+	}
+	
+	statistics.stopReason = TraverseStopReason::emptyStack;
+	return false;
+}
 
-				break;
+template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy>
+void TetMeshFEM::tetrahedralTraversePacket(const TetTraverseRay* rays, int32_t numRays, FloatingType rayTriIntersectionEpsilon,
+	bool* successes, TraverseStatistics* statistics)
+{
+	typedef embree::vfloat<TET_TRAVERSE_PACKET_WIDTH> vfloatP;
+	const int32_t W = TET_TRAVERSE_PACKET_WIDTH;
+	TraverseNoInstrumentation noInstrumentation;
+
+	if (pluckerTraverseEnabled)
+	{
+		for (int32_t iRay = 0; iRay < numRays; iRay++)
+		{
+			const TetTraverseRay& ray = rays[iRay];
+			successes[iRay] = tetrahedralTraverse<StackPolicy, VisitedPolicy, ForwardCheckPolicy>(ray.origin, ray.dir,
+				ray.maxTraversalDis, ray.startTetId, ray.startFaceId, ray.targetTetId, rayTriIntersectionEpsilon, statistics[iRay],
+				noInstrumentation);
+		}
+		return;
+	}
+
+	for (int32_t firstRay = 0; firstRay < numRays; firstRay += W)
+	{
+		const int32_t numLanes = std::min(numRays - firstRay, W);
+
+		// the state of each lane: the tet the ray is in, the face it entered from, and the tet before it;
+		// previousTetIds is -1 while the ray is still in its start tet
+		int32_t tetIds[W], incomingFaceIds[W], previousTetIds[W];
+		// the single exit path of each ray, the candidate stack of tetrahedralTraverse would be empty all along
+		typename TraverseRayVisited<VisitedPolicy>::type traversedTets[W];
+		int activeLanes = 0;
+
+		// origin, axis0 and axis1, the inactive lanes are left zero
+		alignas(32) float frameData[9][W] = {};
+		alignas(32) float posData[4][3][W] = {};
+		for (int32_t iLane = 0; iLane < numLanes; iLane++)
+		{
+			const TetTraverseRay& ray = rays[firstRay + iLane];
+			statistics[firstRay + iLane].stopReason = TraverseStopReason::querySuccess;
+			if (ray.startTetId == ray.targetTetId)
+			{
+				successes[firstRay + iLane] = true;
+				continue;
 			}
+
+			Vec3 axis0, axis1;
+			CuMatrix::buildOrthonormalBasis(ray.dir.data(), axis0.data(), axis1.data());
+			for (int iDim = 0; iDim < 3; iDim++)
+			{
+				frameData[iDim][iLane] = ray.origin(iDim);
+				frameData[3 + iDim][iLane] = axis0(iDim);
+				frameData[6 + iDim][iLane] = axis1(iDim);
+			}
+			tetIds[iLane] = ray.startTetId;
+			incomingFaceIds[iLane] = ray.startFaceId;
+			previousTetIds[iLane] = -1;
+			traversedTets[iLane].reset(numTets(), ray.startTetId);
+			activeLanes |= 1 << iLane;
 		}
-		//std::cout << "Current tet VIds: " << mTetVIds.col(currentTetId).transpose() << std::endl;
 
-		// rearrange the ording of vertices thus the vertex across the incoming face (incomingFaceIdCurTet) is the last one
-		// and the first 3 vertices are ordered as tet4Faces[startFaceId]
-		projectTo2DCoordinates(ptsProj2D, currentTetId, incomingFaceIdCurTet, axesT, rayOrigin);
-		int  numNumIntersectingFaces = exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
+		RayFrameN<W> rayFrame;
+		rayFrame.origin = embree::Vec3<vfloatP>(vfloatP::load(frameData[0]), vfloatP::load(frameData[1]), vfloatP::load(frameData[2]));
+		rayFrame.axis0 = embree::Vec3<vfloatP>(vfloatP::load(frameData[3]), vfloatP::load(frameData[4]), vfloatP::load(frameData[5]));
+		rayFrame.axis1 = embree::Vec3<vfloatP>(vfloatP::load(frameData[6]), vfloatP::load(frameData[7]), vfloatP::load(frameData[8]));
 
-		numNumIntersectingFaces = checkExitFaceForward(rayDir, currentTetId, incomingFaceIdCurTet, possibleExitFace);
-		for (size_t iF = 0; iF < 3; iF++)
+		while (activeLanes)
 		{
-			if (possibleExitFace(iF))
-				// add intersected faces to candidate intersection face stack
+			// the vertices of the tet of each lane, as xyz_ in the order of the tet
+			embree::vfloat4 tetVerts[W][4];
+			for (int32_t iLane = 0; iLane < numLanes; iLane++)
 			{
-				// the exit face id is the actual vertex id (0~3), not how they are arranged in ptsProj2D
-				// exit face id can be deduced from tet4Faces[incomingFaceIdCurTet]
-				int32_t exitFaceId = tet4Faces[incomingFaceIdCurTet][iF];
-				candidateExitFaces.push_back(exitFaceId);
-				candidateExitFacesCorrespondingTets.push_back(currentTetId);
-
-				int32_t nextTetId = tetsNeighborTets(exitFaceId, currentTetId);
-				if (nextTetId == targetTetId)
+				if (!(activeLanes & (1 << iLane)))
 				{
-					statistics.stopReason = TraverseStopReason::querySuccess;
-					return true;
+					continue;
 				}
 
-				if ((!(statistics.numTetsTraversed % passThroughCheckSteps) || statistics.numTetsTraversed == 2)
-					&& maxTraversalDis > 0.f)
-					// check pass through
+				int32_t sourceLane = iLane;
+				for (int32_t iPrevLane = 0; iPrevLane < iLane; iPrevLane++)
 				{
-					Vec3 barys, intersectPt;
-
-					//std::cout << "ptsProj2D: \n" << ptsProj2D << std::endl;
-
-					originBarycentric2DTriangle(ptsProj2D.col(posibleExit3Faces[iF][0]),
-						ptsProj2D.col(posibleExit3Faces[iF][1]),
-						ptsProj2D.col(posibleExit3Faces[iF][2]),
-						barys);
-					intersectPt = Vec3::Zero();
-
-					Eigen::Matrix<FloatingType, 3, 4> ptsPermuted3D;
-					copyRepermutedVerts(ptsPermuted3D, currentTetId, incomingFaceIdCurTet);
-
-					for (size_t iV = 0; iV < 3; iV++)
+					if ((activeLanes & (1 << iPrevLane)) && tetIds[iPrevLane] == tetIds[iLane])
 					{
-						intersectPt += barys(iV) * ptsPermuted3D.col(posibleExit3Faces[iF][iV]);
+						sourceLane = iPrevLane;
+						break;
 					}
+				}
+				const int32_t* tetVIds = tetTopologyVIds(tetIds[iLane]);
+				for (int iV = 0; iV < 4; iV++)
+				{
+					tetVerts[iLane][iV] = sourceLane == iLane ? loadVertex4(tetVIds[iV]) : tetVerts[sourceLane][iV];
+				}
 
-					Vec2 sum = (ptsProj2D.col(posibleExit3Faces[iF][0]) * barys[0]
-						+ ptsProj2D.col(posibleExit3Faces[iF][1]) * barys[1]
-						+ ptsProj2D.col(posibleExit3Faces[iF][2]) * barys[2]);
+				// rearrange the ording of vertices thus the vertex across the incoming face is the last one
+				const int32_t incomingFaceId = incomingFaceIds[iLane];
+				const int32_t repermutedVIds[4] = { tet4Faces[incomingFaceId][0], tet4Faces[incomingFaceId][1],
+					tet4Faces[incomingFaceId][2], incomingFaceId };
+				for (int iV = 0; iV < 4; iV++)
+				{
+					const embree::vfloat4& v = tetVerts[iLane][repermutedVIds[iV]];
+					posData[iV][0][iLane] = v[0];
+					posData[iV][1][iLane] = v[1];
+					posData[iV][2][iLane] = v[2];
+				}
+			}
 
-					if ((intersectPt - rayOrigin).squaredNorm() > maxTraversalDis * maxTraversalDis)
+			TetProjectionN<W> tetProj;
+			for (int iV = 0; iV < 4; iV++)
+			{
+				tetProj.pos[iV] = embree::Vec3<vfloatP>(vfloatP::load(posData[iV][0]), vfloatP::load(posData[iV][1]),
+					vfloatP::load(posData[iV][2]));
+			}
+			projectTetsToRayFramesN(rayFrame, tetProj);
+			int exitFaceMasks[3];
+			exitFaceMasksN(tetProj, rayTriIntersectionEpsilon, exitFaceMasks);
+
+			// the rays with a single exit face go on in the packet
+			alignas(32) float exitFaces[W] = {};
+			int numExitFaces[W];
+			int checkPassThroughLanes = 0;
+			for (int32_t iLane = 0; iLane < numLanes; iLane++)
+			{
+				if (!(activeLanes & (1 << iLane)))
+				{
+					continue;
+				}
+				numExitFaces[iLane] = 0;
+				for (int iF = 0; iF < 3; iF++)
+				{
+					if (exitFaceMasks[iF] & (1 << iLane))
 					{
-						statistics.stopReason = TraverseStopReason::passedMaximumDis;
-						//std::cout << "Passed through maximum traverse dis!\n";
-						return false;
+						exitFaces[iLane] = float(iF);
+						++numExitFaces[iLane];
 					}
 				}
-			}
-		}
-		++statistics.numTetsTraversed;
-	} // while
 
-	statistics.stopReason = TraverseStopReason::emptyStack;
-	return false;
-}
-
-bool SP::TetMeshFEM::tetrahedralTraverseToDynamic(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId,
-	int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics)
-{
-	statistics.stopReason = TraverseStopReason::querySuccess;
-	if (startTetId == targetTetId)
-	{
-		return true;
-	}
-	// get the ray-aligned 2D coordinate system
-	Eigen::Matrix<FloatingType, 3, 2> axes;
-	CuMatrix::buildOrthonormalBasis(rayDir.data(), axes.col(0).data(), axes.col(1).data());
-
-	assert(axes.col(0).dot(axes.col(1)) < 1e-6);
-	assert(axes.col(0).dot(rayDir) < 1e-6);
-	assert(axes.col(1).dot(rayDir) < 1e-6);
-
-	Eigen::Matrix<FloatingType, 2, 3> axesT = axes.transpose();
+				// the start tet is not checked, same as tetrahedralTraverse
+				int numTetsTraversed = statistics[firstRay + iLane].numTetsTraversed;
+				if (numExitFaces[iLane] == 1 && previousTetIds[iLane] != -1 && rays[firstRay + iLane].maxTraversalDis > 0.f
+					&& (!(numTetsTraversed % passThroughCheckSteps) || (StackPolicy::earlyPassThroughCheck && numTetsTraversed == 2)))
+				{
+					checkPassThroughLanes |= 1 << iLane;
+				}
+			}
 
-	// initialize the 2D coordinate
+			alignas(32) float exitFaceDistances2[W];
+			if (checkPassThroughLanes)
+			{
+				vfloatP::store(exitFaceDistances2, exitFaceIntersectionDistances2N(rayFrame, tetProj, vfloatP::load(exitFaces)));
+			}
 
-	Eigen::Matrix<FloatingType, 2, 4> ptsProj2D;
+			for (int32_t iLane = 0; iLane < numLanes; iLane++)
+			{
+				if (!(activeLanes & (1 << iLane)))
+				{
+					continue;
+				}
+				const int32_t iRay = firstRay + iLane;
+				const TetTraverseRay& ray = rays[iRay];
+				TraverseStatistics& rayStatistics = statistics[iRay];
+				const bool atStartTet = previousTetIds[iLane] == -1;
 
-	int count = 0;
-	// rearrange the ording of vertices thus the vertex across the incoming face is the last one
-	// and the first 3 vertices are ordered as tet4Faces[startFaceId]
-	projectTo2DCoordinates(ptsProj2D, startTetId, startFaceId, axesT, rayOrigin);
+				if (numExitFaces[iLane] > 1)
+					// the ray branches, the scalar traverse takes it over from the current tet with the tets visited so far
+				{
+					successes[iRay] = tetrahedralTraverseFrom<StackPolicy, typename TraverseRayVisited<VisitedPolicy>::type,
+						ForwardCheckPolicy>(ray.origin, ray.dir, ray.maxTraversalDis, tetIds[iLane], incomingFaceIds[iLane],
+						atStartTet, ray.targetTetId, rayTriIntersectionEpsilon, traversedTets[iLane], rayStatistics, noInstrumentation);
+					activeLanes &= ~(1 << iLane);
+					continue;
+				}
 
-	Eigen::Vector4i possibleExitFace;
-	exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
+				if (!atStartTet)
+					// the same count of exit faces as tetrahedralTraverse for the loop detection
+				{
+					int numIntersectingFaces = numExitFaces[iLane];
+					if (ForwardCheckPolicy::enabled)
+					{
+						Eigen::Vector4i possibleExitFace;
+						for (int iF = 0; iF < 3; iF++)
+						{
+							possibleExitFace(iF) = (exitFaceMasks[iF] >> iLane) & 1;
+						}
+						numIntersectingFaces = checkExitFaceForward(ray.dir, tetIds[iLane], incomingFaceIds[iLane], possibleExitFace);
+					}
+					traversedTets[iLane].onExitFaces(tetIds[iLane], numIntersectingFaces);
+				}
 
-	// figure out the outcoming Face
-	std::vector<int32_t> candidateExitFaces;
-	std::vector<int32_t> candidateExitFacesCorrespondingTets;
+				if (numExitFaces[iLane] == 0)
+					// dead end
+				{
+					if (!atStartTet)
+					{
+						++rayStatistics.numTetsTraversed;
+					}
+					rayStatistics.stopReason = TraverseStopReason::emptyStack;
+					successes[iRay] = false;
+					activeLanes &= ~(1 << iLane);
+					continue;
+				}
 
-	candidateExitFaces.reserve(SIZE_CANDIDATE_FACE_STACK * 2);
-	candidateExitFacesCorrespondingTets.reserve(SIZE_CANDIDATE_FACE_STACK *2);
+				int32_t exitFaceId = tet4Faces[incomingFaceIds[iLane]][int(exitFaces[iLane])];
+				int32_t nextTetId = tetNeighborTet(tetIds[iLane], exitFaceId);
+				bool stop = false;
+				if (nextTetId == ray.targetTetId)
+				{
+					rayStatistics.stopReason = TraverseStopReason::querySuccess;
+					successes[iRay] = true;
+					stop = true;
+				}
+				else if ((checkPassThroughLanes & (1 << iLane))
+					&& exitFaceDistances2[iLane] > ray.maxTraversalDis * ray.maxTraversalDis)
+				{
+					rayStatistics.stopReason = TraverseStopReason::passedMaximumDis;
+					successes[iRay] = false;
+					stop = true;
+				}
+				else
+				{
+					if (!atStartTet)
+					{
+						++rayStatistics.numTetsTraversed;
+					}
 
-#if defined TRAVERESED_TETS_SET
-	std::unordered_set<int32_t> traversedTets;
-	traversedTets.insert(startTetId);
-#elif defined TRAVERESED_TETS_CIRCULAR_ARRAY
-	CircularArray<int32_t, SIZE_TRAVERSED_CIRCULAR_ARRAY> traversedTets;
-	traversedTets.push_back(startTetId);
-#else
-	std::vector<int32_t> traversedTets;
-	traversedTets.reserve(SIZE_TRAVERSED_LIST_STACK * 2);
-	traversedTets.push_back(startTetId);
-#endif
+					if (nextTetId == -1)
+						// reached the boundary
+					{
+						rayStatistics.stopReason = TraverseStopReason::reachedBoundary;
+						successes[iRay] = false;
+						stop = true;
+					}
+					else if (!traversedTets[iLane].visit(nextTetId))
+						// formed loop, no candidate is left
+					{
+						rayStatistics.stopReason = TraverseStopReason::emptyStack;
+						successes[iRay] = false;
+						stop = true;
+					}
+				}
 
-#ifdef OUTPUT_TRAVERSED_TETS 
-	statistics.statistics.traversedTetsOutput.clear();
-	statistics.statistics.traversedTetsOutput.push_back(startTetId);
-#endif
+				if (stop)
+				{
+					activeLanes &= ~(1 << iLane);
+					continue;
+				}
 
+				previousTetIds[iLane] = tetIds[iLane];
+				incomingFaceIds[iLane] = tetNeighborFaceId(tetIds[iLane], exitFaceId);
+				tetIds[iLane] = nextTetId;
+			}
+		}
+	}
+}
 
-	for (size_t i = 0; i < 3; i++)
+template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy>
+void TetMeshFEM::tetrahedralTraverseWavefront(TetTraverseRaySource& raySource, int32_t wavefrontSize,
+	FloatingType rayTriIntersectionEpsilon)
+{
+	// a ray in the wavefront: the tet it is in, the face it entered from, and the tet before it;
+	// previousTetId is -1 while the ray is still in its start tet
+	struct WavefrontLane
 	{
-		if (possibleExitFace(i))
-		{
-			// the first 3 vertices are ordered as tet4Faces[startFaceId]
-			// thus tet4Faces[startFaceId][i] is the exit face id
-			int32_t exitFaceId = tet4Faces[startFaceId][i];
-
-			candidateExitFaces.push_back(exitFaceId);
-			candidateExitFacesCorrespondingTets.push_back(startTetId);
-		}
+		TetTraverseRay ray;
+		int32_t rayId;
+		Eigen::Matrix<FloatingType, 3, 2> axes;
+		int32_t tetId;
+		int32_t incomingFaceId;
+		int32_t previousTetId;
+		// the single exit path of the ray, the candidate stack of tetrahedralTraverse would be empty all along
+		typename TraverseRayVisited<VisitedPolicy>::type traversedTets;
+		TraverseStatistics statistics;
 	};
-	statistics.numTetsTraversed = 0;
-	while (!candidateExitFaces.empty())
-	{
-		int32_t intersectedFaceId = candidateExitFaces.back();
-		candidateExitFaces.pop_back();
-		int32_t previousTetId = candidateExitFacesCorrespondingTets.back();
-		candidateExitFacesCorrespondingTets.pop_back();
-
-		int32_t intersectedFaceVIds[3] = {
-			mTetVIds(tet4Faces[intersectedFaceId][0], previousTetId),
-			mTetVIds(tet4Faces[intersectedFaceId][1], previousTetId),
-			mTetVIds(tet4Faces[intersectedFaceId][2], previousTetId)
-		};
-
-		int32_t currentTetId = tetsNeighborTets(intersectedFaceId, previousTetId);
+	std::vector<WavefrontLane> lanes(wavefrontSize);
+	int32_t numLanes = 0;
+	TraverseNoInstrumentation noInstrumentation;
 
-		//std::cout << "Previous tet VIds: " << mTetVIds.col(previousTetId).transpose() << std::endl;
-
-#ifdef OUTPUT_TRAVERSED_TETS 
-		statistics.traversedTetsOutput.push_back(currentTetId);
-#endif
-
-		if (currentTetId == targetTetId)
+	auto startRays = [&]() {
+		while (numLanes < wavefrontSize)
 		{
-			statistics.stopReason = TraverseStopReason::querySuccess;
-			return true;
+			WavefrontLane& lane = lanes[numLanes];
+			if (!raySource.nextRay(lane.ray, lane.rayId))
+			{
+				break;
+			}
+
+			lane.statistics = TraverseStatistics();
+			lane.statistics.stopReason = TraverseStopReason::querySuccess;
+			if (lane.ray.startTetId == lane.ray.targetTetId)
+			{
+				raySource.finishRay(lane.rayId, true, lane.statistics);
+				continue;
+			}
+			CuMatrix::buildOrthonormalBasis(lane.ray.dir.data(), lane.axes.col(0).data(), lane.axes.col(1).data());
+			lane.tetId = lane.ray.startTetId;
+			lane.incomingFaceId = lane.ray.startFaceId;
+			lane.previousTetId = -1;
+			lane.traversedTets = typename TraverseRayVisited<VisitedPolicy>::type();
+			lane.traversedTets.reset(numTets(), lane.tetId);
+			prefetchTetTopology(lane.tetId);
+			++numLanes;
 		}
+	};
 
-		if (currentTetId == -1)
-			// reached the boundary
+	// steps the ray of the lane into its next tet, returns true if its traversal is finished
+	auto stepLane = [&](WavefrontLane& lane) {
+		const TetTraverseRay& ray = lane.ray;
+		const bool atStartTet = lane.previousTetId == -1;
+
+		// the same exit face selection and pass through check as tetrahedralTraverse
+		Eigen::Vector4i possibleExitFace;
+		int numExitFaces;
+		Eigen::Matrix<FloatingType, 2, 3> axesT = lane.axes.transpose();
+		Eigen::Matrix<FloatingType, 2, 4> ptsProj2D;
+		RayFrame4 rayFrame;
+		TetProjection4 tetProj;
+		TetRayPlucker plucker;
+		if (pluckerTraverseEnabled)
 		{
-			statistics.stopReason = TraverseStopReason::reachedBoundary;
-			return false;
+			computePluckerProducts(plucker, lane.tetId, lane.incomingFaceId, ray.origin, ray.dir);
+			numExitFaces = exitFaceSelectionPlucker(plucker, possibleExitFace, rayTriIntersectionEpsilon);
 		}
-
-
-#if defined TRAVERESED_TETS_SET
-
-		if (traversedTets.find(currentTetId) != traversedTets.end())
-			// formed loop, cut this branch here
+		else if (simdExitFaceKernelEnabled)
 		{
-			continue;
+			setRayFrame4(rayFrame, ray.origin.data(), lane.axes.col(0).data(), lane.axes.col(1).data());
+			projectTo2DCoordinatesSIMD(tetProj, lane.tetId, lane.incomingFaceId, rayFrame);
+			numExitFaces = exitFaceSelectionSIMD(tetProj, possibleExitFace, rayTriIntersectionEpsilon);
 		}
 		else
 		{
-			traversedTets.insert(currentTetId);
+			projectTo2DCoordinates(ptsProj2D, lane.tetId, lane.incomingFaceId, axesT, ray.origin);
+			numExitFaces = exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
 		}
-#elif defined TRAVERESED_TETS_CIRCULAR_ARRAY
-		if (traversedTets.hasBackward(currentTetId))
+
+		if (numExitFaces > 1)
+			// the ray branches, the scalar traverse takes it over from the current tet with the tets visited so far
 		{
-			continue;
+			bool success = tetrahedralTraverseFrom<StackPolicy, typename TraverseRayVisited<VisitedPolicy>::type,
+				ForwardCheckPolicy>(ray.origin, ray.dir, ray.maxTraversalDis, lane.tetId, lane.incomingFaceId, atStartTet,
+				ray.targetTetId, rayTriIntersectionEpsilon, lane.traversedTets, lane.statistics, noInstrumentation);
+			raySource.finishRay(lane.rayId, success, lane.statistics);
+			return true;
 		}
-#ifndef ONLY_RECORD_BRANCHING_TETS
-		traversedTets.push_back(currentTetId);
-#endif // ONLY_RECORD_BRANCHING_TETS
-#else
-		bool loopDetected = false;
-		int numTraversedTets = traversedTets.size();
-		for (int iTet = 0; iTet < numTraversedTets; iTet++)
+
+		if (!atStartTet)
+			// the same count of exit faces as tetrahedralTraverse for the loop detection
 		{
-			if (traversedTets[iTet] == currentTetId) {
-				loopDetected = true;
-				break;
+			int numIntersectingFaces = numExitFaces;
+			if (ForwardCheckPolicy::enabled)
+			{
+				numIntersectingFaces = checkExitFaceForward(ray.dir, lane.tetId, lane.incomingFaceId, possibleExitFace);
 			}
+			lane.traversedTets.onExitFaces(lane.tetId, numIntersectingFaces);
 		}
-		if (loopDetected)
-		{
-			continue;
-		}
-		traversedTets.push_back(currentTetId);
-#endif
-
-		int32_t newVertexId = tetsXorSums(currentTetId)
-			^ intersectedFaceVIds[0]
-			^ intersectedFaceVIds[1]
-			^ intersectedFaceVIds[2];
 
-		// the intersectedFaceId is not the incoming face id of intersectedFaceId
-		// we need to query the id of the incoming face
-		int32_t incomingFaceIdCurTet = 3;
-		for (size_t iV = 0; iV < 3; iV++)
+		if (numExitFaces == 0)
+			// dead end
 		{
-			if (newVertexId == mTetVIds(iV, currentTetId)) {
-				incomingFaceIdCurTet = iV;
-
-				break;
+			if (!atStartTet)
+			{
+				++lane.statistics.numTetsTraversed;
 			}
+			lane.statistics.stopReason = TraverseStopReason::emptyStack;
+			raySource.finishRay(lane.rayId, false, lane.statistics);
+			return true;
 		}
-		//std::cout << "Current tet VIds: " << mTetVIds.col(currentTetId).transpose() << std::endl;
 
-		// rearrange the ording of vertices thus the vertex across the incoming face (incomingFaceIdCurTet) is the last one
-		// and the first 3 vertices are ordered as tet4Faces[startFaceId]
-		projectTo2DCoordinates(ptsProj2D, currentTetId, incomingFaceIdCurTet, axesT, rayOrigin);
-		int  numNumIntersectingFaces = exitFaceSelection(ptsProj2D, possibleExitFace, rayTriIntersectionEpsilon);
-#ifdef ONLY_RECORD_BRANCHING_TETS
-		if (numNumIntersectingFaces > 1)
+		int iF = possibleExitFace(0) ? 0 : (possibleExitFace(1) ? 1 : 2);
+		int32_t exitFaceId = tet4Faces[lane.incomingFaceId][iF];
+		int32_t nextTetId = tetNeighborTet(lane.tetId, exitFaceId);
+		if (nextTetId == ray.targetTetId)
 		{
-			traversedTets.push_back(currentTetId);
+			lane.statistics.stopReason = TraverseStopReason::querySuccess;
+			raySource.finishRay(lane.rayId, true, lane.statistics);
+			return true;
 		}
-#endif // ONLY_RECORD_BRANCHING_TETS
-		for (size_t iF = 0; iF < 3; iF++)
+
+		if (!atStartTet)
 		{
-			if (possibleExitFace(iF))
-				// add intersected faces to candidate intersection face stack
+			int numTetsTraversed = lane.statistics.numTetsTraversed;
+			bool checkPassThrough = (pluckerTraverseEnabled || !(numTetsTraversed % passThroughCheckSteps)
+				|| (StackPolicy::earlyPassThroughCheck && numTetsTraversed == 2)) && ray.maxTraversalDis > 0.f;
+			if (checkPassThrough)
 			{
-				// the exit face id is the actual vertex id (0~3), not how they are arranged in ptsProj2D
-				// exit face id can be deduced from tet4Faces[incomingFaceIdCurTet]
-				int32_t exitFaceId = tet4Faces[incomingFaceIdCurTet][iF];
-				candidateExitFaces.push_back(exitFaceId);
-				candidateExitFacesCorrespondingTets.push_back(currentTetId);
-				
-				int32_t nextTetId = tetsNeighborTets(exitFaceId, currentTetId);
-				if (nextTetId == targetTetId)
+				FloatingType exitFaceDistance2;
+				if (pluckerTraverseEnabled)
 				{
-					statistics.stopReason = TraverseStopReason::querySuccess;
-					return true;
+					FloatingType exitFaceRayParam = exitFaceRayParameter(plucker, iF);
+					exitFaceDistance2 = exitFaceRayParam * exitFaceRayParam;
 				}
-
-				if ( ( !(statistics.numTetsTraversed % passThroughCheckSteps) || statistics.numTetsTraversed == 2)
-					&& maxTraversalDis > 0.f)
-					// check pass through
+				else if (simdExitFaceKernelEnabled)
 				{
-					Vec3 barys, intersectPt;
-
-					//std::cout << "ptsProj2D: \n" << ptsProj2D << std::endl;
+					alignas(16) float exitFaceDistances2[4];
+					embree::vfloat4::store(exitFaceDistances2, exitFaceIntersectionDistances2(rayFrame, tetProj));
+					exitFaceDistance2 = exitFaceDistances2[iF];
+				}
+				else
+				{
+					exitFaceDistance2 = exitFaceIntersectionDistance2(ptsProj2D, lane.tetId, lane.incomingFaceId, iF, ray.origin);
+				}
+				if (exitFaceDistance2 > ray.maxTraversalDis * ray.maxTraversalDis)
+				{
+					lane.statistics.stopReason = TraverseStopReason::passedMaximumDis;
+					raySource.finishRay(lane.rayId, false, lane.statistics);
+					return true;
+				}
+			}
+			++lane.statistics.numTetsTraversed;
+		}
 
-					originBarycentric2DTriangle(ptsProj2D.col(posibleExit3Faces[iF][0]),
-						ptsProj2D.col(posibleExit3Faces[iF][1]),
-						ptsProj2D.col(posibleExit3Faces[iF][2]),
-						barys);
-					intersectPt = Vec3::Zero();
+		if (nextTetId == -1)
+			// reached the boundary
+		{
+			lane.statistics.stopReason = TraverseStopReason::reachedBoundary;
+			raySource.finishRay(lane.rayId, false, lane.statistics);
+			return true;
+		}
 
-					Eigen::Matrix<FloatingType, 3, 4> ptsPermuted3D;
-					copyRepermutedVerts(ptsPermuted3D, currentTetId, incomingFaceIdCurTet);
+		if (!lane.traversedTets.visit(nextTetId))
+			// formed loop, no candidate is left
+		{
+			lane.statistics.stopReason = TraverseStopReason::emptyStack;
+			raySource.finishRay(lane.rayId, false, lane.statistics);
+			return true;
+		}
 
-					for (size_t iV = 0; iV < 3; iV++)
-					{
-						intersectPt += barys(iV) * ptsPermuted3D.col(posibleExit3Faces[iF][iV]);
-					}
+		lane.previousTetId = lane.tetId;
+		lane.incomingFaceId = tetNeighborFaceId(lane.tetId, exitFaceId);
+		lane.tetId = nextTetId;
+		prefetchTetTopology(nextTetId);
+		return false;
+	};
 
-					Vec2 sum = (ptsProj2D.col(posibleExit3Faces[iF][0]) * barys[0]
-						+ ptsProj2D.col(posibleExit3Faces[iF][1]) * barys[1]
-						+ ptsProj2D.col(posibleExit3Faces[iF][2]) * barys[2]);
+	startRays();
+	while (numLanes)
+	{
+		// the topology of the current tets has been prefetched by the last round
+		for (int32_t iLane = 0; iLane < numLanes; iLane++)
+		{
+			prefetchTetVertices(lanes[iLane].tetId);
+		}
 
-					if ((intersectPt - rayOrigin).squaredNorm() > maxTraversalDis * maxTraversalDis)
-					{
-						statistics.stopReason = TraverseStopReason::passedMaximumDis;
-						//std::cout << "Passed through maximum traverse dis!\n";
-						return false;
-					}
-				}
+		for (int32_t iLane = 0; iLane < numLanes;)
+		{
+			if (stepLane(lanes[iLane]))
+				// the last lane, not stepped yet, takes the place of the finished one
+			{
+				std::swap(lanes[iLane], lanes[--numLanes]);
+			}
+			else
+			{
+				++iLane;
 			}
 		}
-		++statistics.numTetsTraversed;
-	} // while
+		startRays();
+	}
+}
 
-	statistics.stopReason = TraverseStopReason::emptyStack;
-	return false;
+#define INSTANTIATE_TETRAHEDRAL_TRAVERSE(StackPolicy, VisitedPolicy, ForwardCheckPolicy, InstrumentationPolicy) \
+	template bool TetMeshFEM::tetrahedralTraverse<StackPolicy, VisitedPolicy, ForwardCheckPolicy, InstrumentationPolicy>( \
+		const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId, \
+		int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics, InstrumentationPolicy& instrumentation);
+
+#define INSTANTIATE_TETRAHEDRAL_TRAVERSE_MULTI_RAY(StackPolicy, VisitedPolicy, ForwardCheckPolicy) \
+	template void TetMeshFEM::tetrahedralTraversePacket<StackPolicy, VisitedPolicy, ForwardCheckPolicy>( \
+		const TetTraverseRay* rays, int32_t numRays, FloatingType rayTriIntersectionEpsilon, bool* successes, \
+		TraverseStatistics* statistics); \
+	template void TetMeshFEM::tetrahedralTraverseWavefront<StackPolicy, VisitedPolicy, ForwardCheckPolicy>( \
+		TetTraverseRaySource& raySource, int32_t wavefrontSize, FloatingType rayTriIntersectionEpsilon);
+
+// the packet and wavefront traverses have no instrumentation
+#define INSTANTIATE_TETRAHEDRAL_TRAVERSE_INSTRUMENTATIONS(StackPolicy, VisitedPolicy, ForwardCheckPolicy) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE(StackPolicy, VisitedPolicy, ForwardCheckPolicy, TraverseNoInstrumentation) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE(StackPolicy, VisitedPolicy, ForwardCheckPolicy, TraverseRecordTets) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_MULTI_RAY(StackPolicy, VisitedPolicy, ForwardCheckPolicy)
+
+#define INSTANTIATE_TETRAHEDRAL_TRAVERSE_FORWARD_CHECKS(StackPolicy, VisitedPolicy) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_INSTRUMENTATIONS(StackPolicy, VisitedPolicy, TraverseNoForwardCheck) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_INSTRUMENTATIONS(StackPolicy, VisitedPolicy, TraverseForwardCheck)
+
+#define INSTANTIATE_TETRAHEDRAL_TRAVERSE_VISITED_SETS(StackPolicy) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_FORWARD_CHECKS(StackPolicy, TraverseVisitedNone) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_FORWARD_CHECKS(StackPolicy, TraverseVisitedCircularArray) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_FORWARD_CHECKS(StackPolicy, TraverseVisitedBranchingTets) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_FORWARD_CHECKS(StackPolicy, TraverseVisitedList) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_FORWARD_CHECKS(StackPolicy, TraverseVisitedSet) \
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_FORWARD_CHECKS(StackPolicy, TraverseVisitedEpoch)
+
+namespace SP {
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_VISITED_SETS(TraverseStackSpill)
+	INSTANTIATE_TETRAHEDRAL_TRAVERSE_VISITED_SETS(TraverseStackDynamic)
 }
@@ -15,6 +15,14 @@
 #include "CuMatrix/Geometry/Geometry.h"
 #include "CuMatrix/MatrixOps/CuMatrix.h"
 
+#include "TetMeshTraversePolicies.h"
+#include "TetExitFaceSIMD.h"
+#include "TetExitFacePacket.h"
+#include "../common/sys/vector.h"
+#include "../common/math/vec2.h"
+#include "../common/math/vec3.h"
+
+// the tetrahedral traverse of the closest point query outputs the traversed tets (TraverseRecordTets)
 // #define OUTPUT_TRAVERSED_TETS
 // #define TET_TET_ADJACENT_LIST
 // #define KEEP_MESHFRAME_MESHES
@@ -42,13 +50,45 @@ namespace SP {
 
 	};
 
+	// Plucker side products of the ray with the 6 edges of a tet, whose vertices are ordered as projectTo2DCoordinates:
+	// p0 ~ p2 are the incoming face as tet4Faces[incomingFaceId], p3 is across it
+	// the side product of edge a->b is rayDir.dot((a - rayOrigin).cross(b - rayOrigin)), each of them is shared by the 2 faces
+	// adjacent to the edge
+	struct TetRayPlucker
+	{
+		// edges p0->p1, p1->p2, p2->p0
+		FloatingType faceEdgeProducts[3];
+		// edges p3->p0, p3->p1, p3->p2, same as the 2D cross products of exitFaceSelection
+		FloatingType apexEdgeProducts[3];
+		// (p_i - rayOrigin).dot(rayDir)
+		FloatingType vertexRayParameters[4];
+	};
+
 	struct TraverseStatistics
 	{
 		int numTetsTraversed = 0;
 		TraverseStopReason stopReason;
-#ifdef OUTPUT_TRAVERSED_TETS 
-		std::vector<int32_t>& traversedTetsOutput
-#endif
+	};
+
+	// a ray of TetMeshFEM::tetrahedralTraversePacket, the arguments of TetMeshFEM::tetrahedralTraverse
+	struct TetTraverseRay
+	{
+		Vec3 origin;
+		Vec3 dir;
+		FloatingType maxTraversalDis;
+		int32_t startTetId;
+		int32_t startFaceId;
+		int32_t targetTetId;
+	};
+
+	// the rays of TetMeshFEM::tetrahedralTraverseWavefront, pulled whenever the wavefront has a free lane
+	struct TetTraverseRaySource
+	{
+		// outputs the next ray and an id for finishRay, returns false if no ray is ready, the wavefront stops once no ray is
+		// ready and all of its lanes are finished
+		virtual bool nextRay(TetTraverseRay& ray, int32_t& rayId) = 0;
+		// the verdict and the statistics of the traverse of ray rayId, it may make new rays ready
+		virtual void finishRay(int32_t rayId, bool success, const TraverseStatistics& statistics) = 0;
 	};
 
 
@@ -78,6 +118,17 @@ namespace SP {
 		return reasonStr;
 	}
 
+	// packed topology of a tet read by the tetrahedral traverse, 2 records per cache line
+	struct alignas(32) TetTopologyRecord
+	{
+		int32_t vIds[4];
+		// (tetsNeighborTets(i, tetId) << 2) | tetNeighborFaceId(tetId, i), -1 for boundary faces
+		int32_t neighbors[4];
+
+		int32_t neighborTetId(int32_t faceId) const { return neighbors[faceId] == -1 ? -1 : neighbors[faceId] >> 2; }
+		int32_t neighborFaceId(int32_t faceId) const { return neighbors[faceId] & 3; }
+	};
+
 	struct TetMeshFEM 
 	{
 		typedef std::shared_ptr<TetMeshFEM> SharedPtr;
@@ -118,14 +169,44 @@ namespace SP {
 
 		Vec4BlockI SP::TetMeshFEM::tet(size_t i);
 
-		bool tetrahedralTraverseTo(const Vec3 & rayOrigin, const Vec3 & rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId,
-			int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics & statistics);
-
-		bool tetrahedralTraverseToLoopLess(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId,
-			int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics);
-
-		bool tetrahedralTraverseToDynamic(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId,
-			int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics);
+		// depth first traverse of the tets crossed by the ray, from face startFaceId of tet startTetId until reaching targetTetId
+		// the policies are defined in TetMeshTraversePolicies.h, all of their combinations are instantiated in TetMeshFEM.cpp:
+		// - StackPolicy: storage of the candidate exit faces, TraverseStackSpill or TraverseStackDynamic
+		// - VisitedPolicy: loop detection, TraverseVisitedNone, TraverseVisitedCircularArray, TraverseVisitedBranchingTets,
+		//   TraverseVisitedList, TraverseVisitedSet or TraverseVisitedEpoch
+		// - ForwardCheckPolicy: TraverseNoForwardCheck or TraverseForwardCheck
+		// - InstrumentationPolicy: TraverseNoInstrumentation or TraverseRecordTets
+		// statistics.numTetsTraversed counts on from its value, which is 0 for a new traversal
+		template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy, typename InstrumentationPolicy>
+		bool tetrahedralTraverse(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t startTetId, int32_t startFaceId,
+			int32_t targetTetId, FloatingType rayTriIntersectionEpsilon, TraverseStatistics& statistics, InstrumentationPolicy& instrumentation);
+		// tetrahedralTraverse from tet tetId entered from its face incomingFaceId, with the tets visited so far in traversedTets;
+		// if atStartTet, tetId is the start tet of the ray, otherwise it is traversed as the tets the ray steps into
+		template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy, typename InstrumentationPolicy>
+		bool tetrahedralTraverseFrom(const Vec3& rayOrigin, const Vec3& rayDir, const FloatingType maxTraversalDis, int32_t tetId,
+			int32_t incomingFaceId, bool atStartTet, int32_t targetTetId, FloatingType rayTriIntersectionEpsilon,
+			VisitedPolicy& traversedTets, TraverseStatistics& statistics, InstrumentationPolicy& instrumentation);
+		// tetrahedralTraverse of numRays rays, advanced together in packets of TET_TRAVERSE_PACKET_WIDTH rays, one ray per lane
+		// of the exit face kernel of TetExitFacePacket.h; the rays in the same tet read its vertices once
+		// until it branches, a ray is stepped along its single exit path with the loop detection of VisitedPolicy (TraverseRayVisited);
+		// where it branches, tetrahedralTraverseFrom takes it over from its current tet with the tets it has visited, thus the
+		// verdict and the statistics of each ray are the ones of tetrahedralTraverse
+		// with pluckerTraverseEnabled, the rays are traversed one by one by tetrahedralTraverse
+		template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy>
+		void tetrahedralTraversePacket(const TetTraverseRay* rays, int32_t numRays, FloatingType rayTriIntersectionEpsilon,
+			bool* successes, TraverseStatistics* statistics);
+		// tetrahedralTraverse of the rays of raySource, wavefrontSize of them are interleaved: each round steps all of them into
+		// their next tet, after prefetching the vertices of the current tets of all of them, and prefetches the topology of their
+		// next tets for the next round; the traversal is a chain of dependent loads, thus the rounds hide the memory latency
+		// the rays are stepped and handed over to tetrahedralTraverseFrom as in tetrahedralTraversePacket, thus the verdict and the
+		// statistics of each ray are the ones of tetrahedralTraverse
+		template<typename StackPolicy, typename VisitedPolicy, typename ForwardCheckPolicy>
+		void tetrahedralTraverseWavefront(TetTraverseRaySource& raySource, int32_t wavefrontSize,
+			FloatingType rayTriIntersectionEpsilon);
+		// prefetches the topology / the vertex positions of a tet read by the tetrahedral traverse, the vertices are only prefetched
+		// once the topology is in the cache
+		void prefetchTetTopology(int32_t tetId);
+		void prefetchTetVertices(int32_t tetId);
 
 		int32_t getNextTet(int32_t tetId, int32_t exitFaceId);
 		int exitFaceSelection(Eigen::Matrix<FloatingType, 2, 4>& ptsProj2D, Eigen::Vector4i& possibleExitFace,
@@ -136,6 +217,32 @@ namespace SP {
 
 		void projectTo2DCoordinates(Eigen::Matrix<FloatingType, 2, 4>& ptsProj2D, int32_t tetId, int32_t incomingFaceId,
 			const Eigen::Matrix<FloatingType, 2, 3>& axesT, const Vec3& origin);
+		// the squared distance from origin to the intersection of the ray and possible exit face iF (0~2) of the projected tet
+		FloatingType exitFaceIntersectionDistance2(const Eigen::Matrix<FloatingType, 2, 4>& ptsProj2D, int32_t tetId,
+			int32_t incomingFaceId, int iF, const Vec3& origin);
+		// the min barycentric of the intersection of the ray and possible exit face iF (0~2) of the projected tet, the larger the
+		// more centrally the ray passes through the face, used if bestFirstBranchOrderEnabled
+		FloatingType exitFaceBarycentricMargin(const Eigen::Matrix<FloatingType, 2, 4>& ptsProj2D, int iF);
+
+		// SIMD versions of projectTo2DCoordinates and exitFaceSelection (TetExitFaceSIMD.h), used if simdExitFaceKernelEnabled
+		void projectTo2DCoordinatesSIMD(TetProjection4& tetProj, int32_t tetId, int32_t incomingFaceId, const RayFrame4& rayFrame);
+		int exitFaceSelectionSIMD(const TetProjection4& tetProj, Eigen::Vector4i& possibleExitFace,
+			FloatingType rayTriIntersectionEpsilon);
+		// the vertex as xyz_, read from the aligned vertex storage if enabled
+		embree::vfloat4 loadVertex4(int32_t vId);
+
+		// Plucker coordinates versions of projectTo2DCoordinates and exitFaceSelection, used if pluckerTraverseEnabled
+		void computePluckerProducts(TetRayPlucker& plucker, int32_t tetId, int32_t incomingFaceId, const Vec3& rayOrigin,
+			const Vec3& rayDir);
+		int exitFaceSelectionPlucker(const TetRayPlucker& plucker, Eigen::Vector4i& possibleExitFace,
+			FloatingType rayTriIntersectionEpsilon);
+		// the ray parameter of the intersection of the ray and possible exit face iF (0~2), from the barycentrics given by
+		// the side products of its edges
+		FloatingType exitFaceRayParameter(const TetRayPlucker& plucker, int iF);
+		// the barycentric weights of the intersection of the ray and possible exit face iF (0~2), not normalized, the face vertices
+		// are ordered as posibleExit3Faces[iF]
+		void exitFaceBarycentricWeights(const TetRayPlucker& plucker, int iF, FloatingType weights[3]);
+		FloatingType exitFaceBarycentricMarginPlucker(const TetRayPlucker& plucker, int iF);
 
 		inline void TetMeshFEM::copyRepermutedVerts(Eigen::Matrix<FloatingType, 3, 4>& ptsPermuted3D,
 			int32_t tetId, int32_t incomingFaceId);
@@ -149,6 +256,7 @@ namespace SP {
 			const  Eigen::MatrixBase<Derived2x1>& b, const  Eigen::MatrixBase<Derived2x1>& c, Vec3& barys);
 
 		// vId are surface vertex vId
+		// the normal functions below read the surface normal cache if enabled
 		void computeVertexNormal(int32_t surfaceVId, Vec3 & normal);
 		void computeFaceOrientedVolume(int32_t surfaceFaceId, Vec3& orientedVolume);
 		void computeFaceNormal(int32_t surfaceFaceId, Vec3& normal);
@@ -159,6 +267,24 @@ namespace SP {
 		bool DCDEnabled(int32_t iV);
 		bool CCDEnabled(int32_t iV);
 
+		// recomputes tetFacePlanes and tetOrientedVolumes from the current mVertPos, in parallel over the tets
+		// must be called after each position update when tetGeometryCacheEnabled is set
+		void updateTetGeometryCache();
+		// same as CuMatrix::tetPointBarycentricsInTet, reads the tet geometry cache if enabled
+		void tetPointBarycentrics(const FloatingType* p, int32_t tetId, FloatingType* barycentrics);
+
+		// recomputes the surface normal cache from the current mVertPos, in parallel over the surface faces and vertices
+		// must be called after each position update when surfaceNormalCacheEnabled is set
+		void updateSurfaceNormalCache();
+
+		// copies the current mVertPos to alignedVertPos, in parallel over the vertices
+		// must be called after each position update when alignedVertexStorageEnabled is set
+		void updateAlignedVertexStorage();
+		// copies restposeVerts to alignedRestposeVerts, the rest pose is not updated thus it is called once
+		void updateAlignedRestposeStorage();
+		// 3 x numVertices Eigen view of alignedVertPos
+		TAlignedVerticesMap alignedVertPosView();
+
 		//void computeIntersectionPoint(const Vec3& barys, int32_t currentTetId, int32_t incomingFaceId,
 		//	int32_t exitFaceId, Vec3& intersectionPt);
 
@@ -206,6 +332,87 @@ namespace SP {
 		VecDynamicI tetsXorSums;
 		// - each tetrahedron's four neighbor tets, ordered by the tetrahedron cross the corresponding vertex in tetVIds;
 		TTetIdsMat tetsNeighborTets;
+		// - for each face i of each tetrahedron, the id of the same face in tetsNeighborTets(i, tetId), packed as 2 bits per face
+		// (bits 2i and 2i + 1), see tetNeighborFaceId; 0 for boundary faces
+		Eigen::Matrix<uint8_t, Eigen::Dynamic, 1> tetsNeighborFaceIds;
+		// - mTetVIds, tetsNeighborTets and tetsNeighborFaceIds packed per tet, built by buildTetTopologyRecords
+		embree::avector<TetTopologyRecord> tetTopologyRecords;
+		// the tetrahedral traverse reads tetTopologyRecords instead of the separate topology arrays
+		bool packedTetTopologyEnabled = false;
+		// the topology accessors of the tetrahedral traverse, reading tetTopologyRecords if packedTetTopologyEnabled
+		const int32_t* tetTopologyVIds(int32_t tetId);
+		int32_t tetNeighborTet(int32_t tetId, int32_t faceId);
+		int32_t tetNeighborFaceId(int32_t tetId, int32_t faceId);
+		// packs the topology arrays into tetTopologyRecords, requires less than 2^29 tets
+		void buildTetTopologyRecords();
+		// the tetrahedral traverse projects the tets and selects their exit faces with the SIMD kernel of TetExitFaceSIMD.h,
+		// which also computes the passing through max distance check, instead of the Eigen 2D projection
+		bool simdExitFaceKernelEnabled = false;
+		// the tetrahedral traverse selects the exit faces from the signs of the Plucker side products of the ray and the tet edges
+		// (computePluckerProducts) and checks the passing through max distance at each step, instead of every passThroughCheckSteps;
+		// has priority over simdExitFaceKernelEnabled
+		bool pluckerTraverseEnabled = false;
+		// where the ray branches, the tetrahedral traverse explores the exit faces from the one the ray passes through the most
+		// centrally (exitFaceBarycentricMargin) instead of in the face order, thus the speculative branches of the near degenerate
+		// hits are explored last
+		bool bestFirstBranchOrderEnabled = false;
+
+		// renumbers the vertices, tets and surface faces by the Morton codes of their current positions (centroids), called by
+		// initialize if pObjectParams->reorderForLocality is set
+		// all the per vertex / tet / surface face arrays and the ids stored in them are permuted, thus the mesh only speaks the
+		// reordered ids, e.g. mVertPos.col(vertexReorderedIds(originalVId)) is the position of vertex originalVId; the accessors
+		// below and the public queries of DiscreteCollisionDetector take and return the original ids
+		void reorderForLocality();
+		// - id mapping of reorderForLocality, empty if the mesh has not been reordered
+		// - - the original id of each vertex, tet and surface face
+		VecDynamicI vertexOriginalIds;
+		VecDynamicI tetOriginalIds;
+		VecDynamicI surfaceFaceOriginalIds;
+		// - - the reordered id of each original vertex, tet and surface face id
+		VecDynamicI vertexReorderedIds;
+		VecDynamicI tetReorderedIds;
+		VecDynamicI surfaceFaceReorderedIds;
+		bool reordered();
+		// identities if the mesh has not been reordered
+		int32_t originalVertexId(int32_t vId);
+		int32_t originalTetId(int32_t tetId);
+		int32_t originalSurfaceFaceId(int32_t faceId);
+		int32_t reorderedVertexId(int32_t originalVId);
+		int32_t reorderedTetId(int32_t originalTetId);
+		int32_t reorderedSurfaceFaceId(int32_t originalFaceId);
+		// - the per vertex arrays indexed by the original vertex ids
+		Vec3Block vertexByOriginalId(size_t originalVId);
+		Vec3Block velocityByOriginalId(size_t originalVId);
+		FloatingType& vertexMassByOriginalId(size_t originalVId);
+		int8_t& fixedByOriginalId(size_t originalVId);
+		// the vertex positions (3 x numVertices()) in the original vertex order
+		void getVerticesOriginalOrder(TVerticesMat& verts);
+		void setVerticesOriginalOrder(const TVerticesMat& verts);
+		// - per-step tet geometry cache, see updateTetGeometryCache; when enabled, the inclusion test, barycentric mapping
+		// and traversal read the cache instead of recomputing triple products from mVertPos
+		bool tetGeometryCacheEnabled = false;
+		// - - each tetrahedron's four outward face planes (faces ordered as tet4Faces)
+		// a point p is strictly inside the tetrahedron iff n_i.p + d_i < 0 for all the 4 faces;
+		// all zero for degenerate tets, thus no point is inside them
+		TTetFacePlanesMat tetFacePlanes;
+		// - - each tetrahedron's signed volume x 6, as CuMatrix::tetOrientedVolume
+		VecDynamic tetOrientedVolumes;
+		// - per-step surface normal cache, see updateSurfaceNormalCache
+		bool surfaceNormalCacheEnabled = false;
+		// - - 3 x numSurfaceFaces, as computeFaceOrientedVolume
+		TVerticesMat surfaceFaceOrientedAreas;
+		// - - 3 x numSurfaceFaces, as computeFaceNormal
+		TVerticesMat surfaceFaceNormals;
+		// - - 9 x numSurfaceFaces, normals of the 3 edges of each face (AB, BC, CA), as computeEdgeNormal
+		Eigen::Matrix<FloatingType, 9, Eigen::Dynamic> surfaceFaceEdgeNormals;
+		// - - 3 x numSurfaceVerts, area weighted, as computeVertexNormal
+		TVerticesMat surfaceVertexNormals;
+		// - 16 byte aligned xyz_ copies of the vertex positions, see updateAlignedVertexStorage; when enabled, the collision
+		// detector loads the positions from them with aligned loads and hands them to Embree as its vertex buffers
+		// mVertPos stays the authoritative storage, that the simulation writes to
+		bool alignedVertexStorageEnabled = false;
+		embree::avector<embree::Vec3fa> alignedVertPos;
+		embree::avector<embree::Vec3fa> alignedRestposeVerts;
 
 
 		VecDynamicI surfaceEdges;
@@ -316,6 +523,103 @@ namespace SP {
 		return int32_t();
 	}
 
+	inline const int32_t* TetMeshFEM::tetTopologyVIds(int32_t tetId)
+	{
+		return packedTetTopologyEnabled ? tetTopologyRecords[tetId].vIds : mTetVIds.col(tetId).data();
+	}
+
+	inline int32_t TetMeshFEM::tetNeighborTet(int32_t tetId, int32_t faceId)
+	{
+		return packedTetTopologyEnabled ? tetTopologyRecords[tetId].neighborTetId(faceId) : tetsNeighborTets(faceId, tetId);
+	}
+
+	inline int32_t TetMeshFEM::tetNeighborFaceId(int32_t tetId, int32_t faceId)
+	{
+		if (packedTetTopologyEnabled)
+		{
+			return tetTopologyRecords[tetId].neighborFaceId(faceId);
+		}
+		return (tetsNeighborFaceIds(tetId) >> (2 * faceId)) & 3;
+	}
+
+	inline void TetMeshFEM::prefetchTetTopology(int32_t tetId)
+	{
+		if (packedTetTopologyEnabled)
+		{
+			embree::prefetchL1(&tetTopologyRecords[tetId]);
+			return;
+		}
+		embree::prefetchL1(mTetVIds.col(tetId).data());
+		embree::prefetchL1(tetsNeighborTets.col(tetId).data());
+		embree::prefetchL1(&tetsNeighborFaceIds(tetId));
+	}
+
+	inline void TetMeshFEM::prefetchTetVertices(int32_t tetId)
+	{
+		// only the SIMD exit face kernel reads the aligned vertex storage
+		bool alignedVerts = alignedVertexStorageEnabled && simdExitFaceKernelEnabled && !pluckerTraverseEnabled;
+		const int32_t* tetVIds = tetTopologyVIds(tetId);
+		for (int iV = 0; iV < 4; iV++)
+		{
+			embree::prefetchL1(alignedVerts ? (const void*)&alignedVertPos[tetVIds[iV]] : (const void*)mVertPos.col(tetVIds[iV]).data());
+		}
+	}
+
+	inline bool TetMeshFEM::reordered()
+	{
+		return vertexOriginalIds.size() != 0;
+	}
+
+	inline int32_t TetMeshFEM::originalVertexId(int32_t vId)
+	{
+		return reordered() ? vertexOriginalIds(vId) : vId;
+	}
+
+	inline int32_t TetMeshFEM::originalTetId(int32_t tetId)
+	{
+		return reordered() ? tetOriginalIds(tetId) : tetId;
+	}
+
+	inline int32_t TetMeshFEM::originalSurfaceFaceId(int32_t faceId)
+	{
+		return reordered() ? surfaceFaceOriginalIds(faceId) : faceId;
+	}
+
+	inline int32_t TetMeshFEM::reorderedVertexId(int32_t originalVId)
+	{
+		return reordered() ? vertexReorderedIds(originalVId) : originalVId;
+	}
+
+	inline int32_t TetMeshFEM::reorderedTetId(int32_t originalTetId)
+	{
+		return reordered() ? tetReorderedIds(originalTetId) : originalTetId;
+	}
+
+	inline int32_t TetMeshFEM::reorderedSurfaceFaceId(int32_t originalFaceId)
+	{
+		return reordered() ? surfaceFaceReorderedIds(originalFaceId) : originalFaceId;
+	}
+
+	inline Vec3Block TetMeshFEM::vertexByOriginalId(size_t originalVId)
+	{
+		return vertex(reorderedVertexId(originalVId));
+	}
+
+	inline Vec3Block TetMeshFEM::velocityByOriginalId(size_t originalVId)
+	{
+		return velocity(reorderedVertexId(originalVId));
+	}
+
+	inline FloatingType& TetMeshFEM::vertexMassByOriginalId(size_t originalVId)
+	{
+		return vertexMass(reorderedVertexId(originalVId));
+	}
+
+	inline int8_t& TetMeshFEM::fixedByOriginalId(size_t originalVId)
+	{
+		return fixedMask(reorderedVertexId(originalVId));
+	}
+
 	inline FloatingType signedSquare(FloatingType v) { return copysignf(v * v, v); }
 
 
@@ -390,11 +694,11 @@ namespace SP {
 	inline int TetMeshFEM::checkExitFaceForward(const Vec3& rayDir, int32_t currentTetId, int32_t incomingFaceIdCurTet,
 		Eigen::Vector4i& possibleExitFace)
 	{
-		Eigen::Matrix<FloatingType, 3, 4> ptsPermuted3D;
-		copyRepermutedVerts(ptsPermuted3D, currentTetId, incomingFaceIdCurTet);
 		int32_t* tetVIds = mTetVIds.col(currentTetId).data();
 
-		float tetOrientedVolume = CuMatrix::tetOrientedVolume(mVertPos.data(), tetVIds);
+		// the cached face planes are already oriented by the sign of the volume, but they vanish for degenerate tets
+		bool useCache = tetGeometryCacheEnabled && tetOrientedVolumes(currentTetId) != 0.f;
+		float tetOrientedVolume = useCache ? tetOrientedVolumes(currentTetId) : CuMatrix::tetOrientedVolume(mVertPos.data(), tetVIds);
 		FloatingType tetOrientedVolumeSign = copysignf(1.0f, tetOrientedVolume);
 
 		int numExitFaces = 0;
@@ -403,8 +707,17 @@ namespace SP {
 			if (possibleExitFace(iF)) {
 				Vec3 exitFaceNormal;
 				int32_t exitFaceId = tet4Faces[incomingFaceIdCurTet][iF];
-				CuMatrix::triangleOrientedArea(mVertPos.data(), tetVIds[tet4Faces[incomingFaceIdCurTet][0]],
-					tetVIds[tet4Faces[incomingFaceIdCurTet][1]], tetVIds[tet4Faces[incomingFaceIdCurTet][2]], exitFaceNormal.data());
+				if (useCache)
+				{
+					const FloatingType* planes = tetFacePlanes.col(currentTetId).data();
+					exitFaceNormal << planes[incomingFaceIdCurTet], planes[4 + incomingFaceIdCurTet], planes[8 + incomingFaceIdCurTet];
+					exitFaceNormal *= tetOrientedVolumeSign;
+				}
+				else
+				{
+					CuMatrix::triangleOrientedArea(mVertPos.data(), tetVIds[tet4Faces[incomingFaceIdCurTet][0]],
+						tetVIds[tet4Faces[incomingFaceIdCurTet][1]], tetVIds[tet4Faces[incomingFaceIdCurTet][2]], exitFaceNormal.data());
+				}
 
 				if (rayDir.dot(exitFaceNormal / exitFaceNormal.norm()) * tetOrientedVolumeSign > 0)
 				{
@@ -421,10 +734,31 @@ namespace SP {
 	}
 
 
+	inline void TetMeshFEM::tetPointBarycentrics(const FloatingType* p, int32_t tetId, FloatingType* barycentrics)
+	{
+		if (!tetGeometryCacheEnabled)
+		{
+			CuMatrix::tetPointBarycentricsInTet((FloatingType*)p, mVertPos.data(), mTetVIds.col(tetId).data(), barycentrics);
+			return;
+		}
+
+		// the oriented face normal i dotted with (p - face vertex) is the sub tet volume across vertex i, oriented by the tet volume
+		// measured from a face vertex instead of using the plane offset, to avoid cancellation far away from the origin
+		const FloatingType* planes = tetFacePlanes.col(tetId).data();
+		FloatingType tetVolumeAbs = fabsf(tetOrientedVolumes(tetId));
+		for (int32_t i = 0; i < 3; ++i)
+		{
+			const FloatingType* v0 = mVertPos.col(mTetVIds(tet4Faces[i][0], tetId)).data();
+			barycentrics[i] = -(planes[i] * (p[0] - v0[0]) + planes[4 + i] * (p[1] - v0[1]) + planes[8 + i] * (p[2] - v0[2]))
+				/ tetVolumeAbs;
+		}
+		barycentrics[3] = 1.f - barycentrics[0] - barycentrics[1] - barycentrics[2];
+	}
+
 	inline void TetMeshFEM::projectTo2DCoordinates(Eigen::Matrix<FloatingType, 2, 4>& ptsProj2D, int32_t tetId, int32_t incomingFaceId,
 		const Eigen::Matrix<FloatingType, 2, 3>& axesT, const Vec3& origin)
 	{
-		int32_t* tetVIds = mTetVIds.col(tetId).data();
+		const int32_t* tetVIds = tetTopologyVIds(tetId);
 		int32_t repermutedTetVIds[4] = {
 			tetVIds[tet4Faces[incomingFaceId][0]],
 			tetVIds[tet4Faces[incomingFaceId][1]],
@@ -440,10 +774,158 @@ namespace SP {
 
 	}
 
+	inline FloatingType TetMeshFEM::exitFaceIntersectionDistance2(const Eigen::Matrix<FloatingType, 2, 4>& ptsProj2D,
+		int32_t tetId, int32_t incomingFaceId, int iF, const Vec3& origin)
+	{
+		Vec3 barys, intersectPt;
+
+		originBarycentric2DTriangle(ptsProj2D.col(posibleExit3Faces[iF][0]),
+			ptsProj2D.col(posibleExit3Faces[iF][1]),
+			ptsProj2D.col(posibleExit3Faces[iF][2]),
+			barys);
+		intersectPt = Vec3::Zero();
+
+		Eigen::Matrix<FloatingType, 3, 4> ptsPermuted3D;
+		copyRepermutedVerts(ptsPermuted3D, tetId, incomingFaceId);
+
+		intersectPt += barys(0) * ptsPermuted3D.col(posibleExit3Faces[iF][0])
+		            +  barys(1) * ptsPermuted3D.col(posibleExit3Faces[iF][1])
+		            +  barys(2) * ptsPermuted3D.col(posibleExit3Faces[iF][2]);
+
+		return (intersectPt - origin).squaredNorm();
+	}
+
+	inline FloatingType TetMeshFEM::exitFaceBarycentricMargin(const Eigen::Matrix<FloatingType, 2, 4>& ptsProj2D, int iF)
+	{
+		Vec3 barys;
+		originBarycentric2DTriangle(ptsProj2D.col(posibleExit3Faces[iF][0]),
+			ptsProj2D.col(posibleExit3Faces[iF][1]),
+			ptsProj2D.col(posibleExit3Faces[iF][2]),
+			barys);
+		return barys.minCoeff();
+	}
+
+	inline embree::vfloat4 TetMeshFEM::loadVertex4(int32_t vId)
+	{
+		if (alignedVertexStorageEnabled)
+		{
+			return embree::vfloat4(alignedVertPos[vId].m128);
+		}
+		// mVertPos has an extra column, thus the 4th float of the last vertex is readable
+		return embree::vfloat4::loadu(mVertPos.col(vId).data());
+	}
+
+	inline void TetMeshFEM::projectTo2DCoordinatesSIMD(TetProjection4& tetProj, int32_t tetId, int32_t incomingFaceId,
+		const RayFrame4& rayFrame)
+	{
+		const int32_t* tetVIds = tetTopologyVIds(tetId);
+		projectTetToRayFrame4(rayFrame,
+			loadVertex4(tetVIds[tet4Faces[incomingFaceId][0]]),
+			loadVertex4(tetVIds[tet4Faces[incomingFaceId][1]]),
+			loadVertex4(tetVIds[tet4Faces[incomingFaceId][2]]),
+			loadVertex4(tetVIds[incomingFaceId]),
+			tetProj);
+	}
+
+	inline int TetMeshFEM::exitFaceSelectionSIMD(const TetProjection4& tetProj, Eigen::Vector4i& possibleExitFace,
+		FloatingType rayTriIntersectionEpsilon)
+	{
+		int exitFaceMask = exitFaceMask4(tetProj, rayTriIntersectionEpsilon);
+		possibleExitFace << (exitFaceMask & 1), (exitFaceMask >> 1) & 1, (exitFaceMask >> 2) & 1, 0;
+		return possibleExitFace(0) + possibleExitFace(1) + possibleExitFace(2);
+	}
+
+	inline void TetMeshFEM::computePluckerProducts(TetRayPlucker& plucker, int32_t tetId, int32_t incomingFaceId,
+		const Vec3& rayOrigin, const Vec3& rayDir)
+	{
+		const int32_t* tetVIds = tetTopologyVIds(tetId);
+		Vec3 p0 = vertex(tetVIds[tet4Faces[incomingFaceId][0]]) - rayOrigin;
+		Vec3 p1 = vertex(tetVIds[tet4Faces[incomingFaceId][1]]) - rayOrigin;
+		Vec3 p2 = vertex(tetVIds[tet4Faces[incomingFaceId][2]]) - rayOrigin;
+		Vec3 p3 = vertex(tetVIds[incomingFaceId]) - rayOrigin;
+
+		// rayDir.dot(a.cross(b)) = a.dot(b.cross(rayDir))
+		Vec3 m0 = p0.cross(rayDir);
+		Vec3 m1 = p1.cross(rayDir);
+		Vec3 m2 = p2.cross(rayDir);
+
+		plucker.faceEdgeProducts[0] = p0.dot(m1);
+		plucker.faceEdgeProducts[1] = p1.dot(m2);
+		plucker.faceEdgeProducts[2] = p2.dot(m0);
+		plucker.apexEdgeProducts[0] = p3.dot(m0);
+		plucker.apexEdgeProducts[1] = p3.dot(m1);
+		plucker.apexEdgeProducts[2] = p3.dot(m2);
+
+		plucker.vertexRayParameters[0] = p0.dot(rayDir);
+		plucker.vertexRayParameters[1] = p1.dot(rayDir);
+		plucker.vertexRayParameters[2] = p2.dot(rayDir);
+		plucker.vertexRayParameters[3] = p3.dot(rayDir);
+	}
+
+	inline int TetMeshFEM::exitFaceSelectionPlucker(const TetRayPlucker& plucker, Eigen::Vector4i& possibleExitFace,
+		FloatingType rayTriIntersectionEpsilon)
+	{
+		// the sum of the side products of the incoming face edges is its projected area x 2
+		FloatingType inComingTriangleAreaSign = copysignf(1.0f,
+			plucker.faceEdgeProducts[0] + plucker.faceEdgeProducts[1] + plucker.faceEdgeProducts[2]);
+
+		const FloatingType* apex = plucker.apexEdgeProducts;
+		int numExitFaces = 0;
+		for (int iF = 0; iF < 3; iF++)
+		{
+			// the face across p_iF is bounded by the edges p3->p_(iF + 1) % 3 and p3->p_(iF + 2) % 3
+			possibleExitFace(iF) = apex[(iF + 1) % 3] * inComingTriangleAreaSign >= -rayTriIntersectionEpsilon
+				&& apex[(iF + 2) % 3] * inComingTriangleAreaSign <= rayTriIntersectionEpsilon;
+			numExitFaces += possibleExitFace(iF);
+		}
+		possibleExitFace(3) = 0;
+
+		return numExitFaces;
+	}
+
+	inline void TetMeshFEM::exitFaceBarycentricWeights(const TetRayPlucker& plucker, int iF, FloatingType weights[3])
+	{
+		// the barycentric weight of a vertex of face (a, b, c) is the side product of the edge across it, oriented a->b->c
+		const FloatingType* face = plucker.faceEdgeProducts;
+		const FloatingType* apex = plucker.apexEdgeProducts;
+		switch (iF)
+		{
+		case 0:
+			// (p1, p2, p3)
+			weights[0] = -apex[2]; weights[1] = apex[1]; weights[2] = face[1];
+			break;
+		case 1:
+			// (p0, p2, p3)
+			weights[0] = -apex[2]; weights[1] = apex[0]; weights[2] = -face[2];
+			break;
+		default:
+			// (p0, p1, p3)
+			weights[0] = -apex[1]; weights[1] = apex[0]; weights[2] = face[0];
+			break;
+		}
+	}
+
+	inline FloatingType TetMeshFEM::exitFaceRayParameter(const TetRayPlucker& plucker, int iF)
+	{
+		FloatingType w[3];
+		exitFaceBarycentricWeights(plucker, iF, w);
+		const FloatingType* t = plucker.vertexRayParameters;
+		const int32_t* faceVIds = posibleExit3Faces[iF];
+		return (w[0] * t[faceVIds[0]] + w[1] * t[faceVIds[1]] + w[2] * t[faceVIds[2]]) / (w[0] + w[1] + w[2]);
+	}
+
+	inline FloatingType TetMeshFEM::exitFaceBarycentricMarginPlucker(const TetRayPlucker& plucker, int iF)
+	{
+		FloatingType w[3];
+		exitFaceBarycentricWeights(plucker, iF, w);
+		FloatingType wSum = w[0] + w[1] + w[2];
+		return std::min(std::min(w[0] / wSum, w[1] / wSum), w[2] / wSum);
+	}
+
 	inline void TetMeshFEM::copyRepermutedVerts(Eigen::Matrix<FloatingType, 3, 4>& ptsPermuted3D,
 		int32_t tetId, int32_t incomingFaceId)
 	{
-		int32_t* tetVIds = mTetVIds.col(tetId).data();
+		const int32_t* tetVIds = tetTopologyVIds(tetId);
 		int32_t repermutedTetVIds[4] = {
 			tetVIds[tet4Faces[incomingFaceId][0]],
 			tetVIds[tet4Faces[incomingFaceId][1]],
@@ -468,6 +950,12 @@ namespace SP {
 
 	inline void TetMeshFEM::computeFaceNormal(int32_t surfaceFaceId, Vec3& normal)
 	{
+		if (surfaceNormalCacheEnabled)
+		{
+			normal = surfaceFaceNormals.col(surfaceFaceId);
+			return;
+		}
+
 		computeFaceOrientedVolume(surfaceFaceId, normal);
 		normal /= normal.norm();
 
@@ -475,6 +963,12 @@ namespace SP {
 
 	inline void TetMeshFEM::computeEdgeNormal(int32_t faceId, int32_t edgeId, Vec3& normal)
 	{
+		if (surfaceNormalCacheEnabled)
+		{
+			normal = surfaceFaceEdgeNormals.block<3, 1>(3 * edgeId, faceId);
+			return;
+		}
+
 		int32_t neiFaceId = surfaceFaces3NeighborFaces(edgeId, faceId);
 
 		Vec3 n1, n2;
@@ -497,6 +991,12 @@ namespace SP {
 
 	inline void TetMeshFEM::computeVertexNormal(int32_t surfaceVId, Vec3& normal)
 	{
+		if (surfaceNormalCacheEnabled)
+		{
+			normal = surfaceVertexNormals.col(surfaceVId);
+			return;
+		}
+
 		normal = Vec3::Zero();
 		for (int iF = 0; iF < surfaceVertexNeighborSurfaceFaces[surfaceVId].size(); iF++)
 		{
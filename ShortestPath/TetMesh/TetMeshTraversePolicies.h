@@ -0,0 +1,309 @@
+#pragma once
+
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <MeshFrame/Memory/Array.h>
+
+#define SIZE_CANDIDATE_FACE_STACK 32
+#define SIZE_TRAVERSED_LIST_STACK 128
+#define SIZE_TRAVERSED_CIRCULAR_ARRAY 32
+
+// policies of TetMeshFEM::tetrahedralTraverse, each traversal variant is an instantiation of the same engine
+// the policies are resolved at compile time, a disabled policy compiles to nothing
+namespace SP {
+	// a face of a traversed tet crossed by the ray, the tet across it is yet to be traversed
+	struct TraverseCandidate
+	{
+		int32_t exitFaceId;
+		int32_t tetId;
+	};
+
+	// the exit faces of a tet where the ray branches, keyed by their barycentric margins: the min barycentric of the intersection
+	// of the ray and the face, the larger the more centrally the ray passes through it
+	// pop returns the least central branch first, thus pushing them to the candidate stack in this order makes the most central
+	// branch the first one explored
+	struct TraverseBranchHeap
+	{
+		bool empty() const { return size == 0; }
+
+		void push(const TraverseCandidate& candidate, float margin)
+		{
+			branches[size++] = { margin, candidate };
+			std::push_heap(branches, branches + size, moreCentral);
+		}
+
+		TraverseCandidate pop()
+		{
+			std::pop_heap(branches, branches + size, moreCentral);
+			return branches[--size].candidate;
+		}
+
+	private:
+		struct Branch
+		{
+			float margin;
+			TraverseCandidate candidate;
+		};
+
+		static bool moreCentral(const Branch& a, const Branch& b) { return a.margin > b.margin; }
+
+		// a tet has at most 3 exit faces
+		Branch branches[3];
+		int32_t size = 0;
+	};
+
+	// - stack policies: the candidate exit faces of the depth first traversal
+	// earlyPassThroughCheck: the passing through max distance check also runs at the 3rd traversed tet, not only every
+	// passThroughCheckSteps tets
+
+	// in place storage of SIZE_CANDIDATE_FACE_STACK candidates, spilled to the heap when full and the traversal goes on
+	struct TraverseStackSpill
+	{
+		static const bool earlyPassThroughCheck = false;
+
+		bool empty() const { return size == 0; }
+
+		void push(const TraverseCandidate& candidate)
+		{
+			if (size == capacity)
+			{
+				spill();
+			}
+			stack[size++] = candidate;
+		}
+
+		TraverseCandidate pop() { return stack[--size]; }
+
+	private:
+		void spill()
+		{
+			if (stack == inPlaceStack)
+			{
+				spilledStack.assign(inPlaceStack, inPlaceStack + size);
+			}
+			capacity *= 2;
+			spilledStack.resize(capacity);
+			stack = spilledStack.data();
+		}
+
+		TraverseCandidate inPlaceStack[SIZE_CANDIDATE_FACE_STACK];
+		std::vector<TraverseCandidate> spilledStack;
+		TraverseCandidate* stack = inPlaceStack;
+		int32_t capacity = SIZE_CANDIDATE_FACE_STACK;
+		int32_t size = 0;
+	};
+
+	// heap storage
+	struct TraverseStackDynamic
+	{
+		static const bool earlyPassThroughCheck = true;
+
+		TraverseStackDynamic() { stack.reserve(SIZE_CANDIDATE_FACE_STACK * 2); }
+
+		bool empty() const { return stack.empty(); }
+		void push(const TraverseCandidate& candidate) { stack.push_back(candidate); }
+
+		TraverseCandidate pop()
+		{
+			TraverseCandidate candidate = stack.back();
+			stack.pop_back();
+			return candidate;
+		}
+
+		std::vector<TraverseCandidate> stack;
+	};
+
+	// - visited set policies: loop detection of the traversal
+	// reset(numTets, startTetId) starts a traversal of a mesh of numTets tets from startTetId;
+	// visit(tetId) returns false if the tet has been visited, which cuts the branch;
+	// onExitFaces(tetId, numExitFaces) is called once the exit faces of a visited tet are selected
+
+	// no loop detection
+	struct TraverseVisitedNone
+	{
+		void reset(size_t numTets, int32_t startTetId) {}
+		bool visit(int32_t tetId) { return true; }
+		void onExitFaces(int32_t tetId, int numExitFaces) {}
+	};
+
+	// the last SIZE_TRAVERSED_CIRCULAR_ARRAY visited tets, only detects short loops
+	struct TraverseVisitedCircularArray
+	{
+		void reset(size_t numTets, int32_t startTetId) { traversedTets.push_back(startTetId); }
+
+		bool visit(int32_t tetId)
+		{
+			if (traversedTets.hasBackward(tetId))
+			{
+				return false;
+			}
+			traversedTets.push_back(tetId);
+			return true;
+		}
+
+		void onExitFaces(int32_t tetId, int numExitFaces) {}
+
+		CircularArray<int32_t, SIZE_TRAVERSED_CIRCULAR_ARRAY> traversedTets;
+	};
+
+	// same as TraverseVisitedCircularArray, but only records the tets where the ray branches
+	struct TraverseVisitedBranchingTets
+	{
+		void reset(size_t numTets, int32_t startTetId) { traversedTets.push_back(startTetId); }
+		bool visit(int32_t tetId) { return !traversedTets.hasBackward(tetId); }
+
+		void onExitFaces(int32_t tetId, int numExitFaces)
+		{
+			if (numExitFaces > 1)
+			{
+				traversedTets.push_back(tetId);
+			}
+		}
+
+		CircularArray<int32_t, SIZE_TRAVERSED_CIRCULAR_ARRAY> traversedTets;
+	};
+
+	// all the visited tets, linear search
+	struct TraverseVisitedList
+	{
+		TraverseVisitedList() { traversedTets.reserve(SIZE_TRAVERSED_LIST_STACK); }
+
+		void reset(size_t numTets, int32_t startTetId) { traversedTets.push_back(startTetId); }
+
+		bool visit(int32_t tetId)
+		{
+			for (size_t iTet = 0; iTet < traversedTets.size(); iTet++)
+			{
+				if (traversedTets[iTet] == tetId)
+				{
+					return false;
+				}
+			}
+			traversedTets.push_back(tetId);
+			return true;
+		}
+
+		void onExitFaces(int32_t tetId, int numExitFaces) {}
+
+		std::vector<int32_t> traversedTets;
+	};
+
+	// all the visited tets, hashed
+	struct TraverseVisitedSet
+	{
+		void reset(size_t numTets, int32_t startTetId) { traversedTets.insert(startTetId); }
+		bool visit(int32_t tetId) { return traversedTets.insert(tetId).second; }
+		void onExitFaces(int32_t tetId, int numExitFaces) {}
+
+		std::unordered_set<int32_t> traversedTets;
+	};
+
+	// visited stamps of all the tets, shared by the traversals of a thread: a tet has been visited by the current traversal iff
+	// its stamp is the current epoch, thus a new traversal only increments the epoch
+	struct TetVisitedStamps
+	{
+		std::vector<uint32_t> stamps;
+		uint32_t epoch = 0;
+	};
+
+	inline TetVisitedStamps& threadTetVisitedStamps()
+	{
+		static thread_local TetVisitedStamps visitedStamps;
+		return visitedStamps;
+	}
+
+	// all the visited tets, exact and allocation free after the first traversal of the largest mesh
+	// the stamps are shared by the meshes, the epoch of the new traversal is never stamped on any of their tets
+	struct TraverseVisitedEpoch
+	{
+		void reset(size_t numTets, int32_t startTetId)
+		{
+			TetVisitedStamps& visitedStamps = threadTetVisitedStamps();
+			if (visitedStamps.stamps.size() < numTets)
+			{
+				visitedStamps.stamps.resize(numTets, 0);
+			}
+			if (++visitedStamps.epoch == 0)
+				// wrapped around, the old stamps could collide with the new epochs
+			{
+				std::fill(visitedStamps.stamps.begin(), visitedStamps.stamps.end(), 0);
+				visitedStamps.epoch = 1;
+			}
+			stamps = visitedStamps.stamps.data();
+			epoch = visitedStamps.epoch;
+			stamps[startTetId] = epoch;
+		}
+
+		bool visit(int32_t tetId)
+		{
+			if (stamps[tetId] == epoch)
+			{
+				return false;
+			}
+			stamps[tetId] = epoch;
+			return true;
+		}
+
+		void onExitFaces(int32_t tetId, int numExitFaces) {}
+
+		uint32_t* stamps = nullptr;
+		uint32_t epoch = 0;
+	};
+
+	// loop detection of the static and dynamic traversals
+	typedef TraverseVisitedCircularArray TraverseVisitedDefault;
+
+	// loop detection of each ray of TetMeshFEM::tetrahedralTraversePacket and tetrahedralTraverseWavefront along its single exit
+	// path, the same as VisitedPolicy; the stamps of TraverseVisitedEpoch are shared by the thread, thus the rays use
+	// TraverseVisitedList, also exact, instead
+	template<typename VisitedPolicy>
+	struct TraverseRayVisited
+	{
+		typedef VisitedPolicy type;
+	};
+
+	template<>
+	struct TraverseRayVisited<TraverseVisitedEpoch>
+	{
+		typedef TraverseVisitedList type;
+	};
+
+	// - forward check policies: whether the exit faces are checked against the ray direction (TetMeshFEM::checkExitFaceForward)
+
+	struct TraverseNoForwardCheck
+	{
+		static const bool enabled = false;
+	};
+
+	struct TraverseForwardCheck
+	{
+		static const bool enabled = true;
+	};
+
+	// the policies of a traversal as a type, e.g. to pass them to a generic lambda
+	template<typename StackPolicyT, typename VisitedPolicyT, typename ForwardCheckPolicyT>
+	struct TraversePolicies
+	{
+		typedef StackPolicyT StackPolicy;
+		typedef VisitedPolicyT VisitedPolicy;
+		typedef ForwardCheckPolicyT ForwardCheckPolicy;
+	};
+
+	// - instrumentation policies: record(tetId) is called for the start tet and for each tet the traversal steps into
+
+	struct TraverseNoInstrumentation
+	{
+		void record(int32_t tetId) {}
+	};
+
+	// outputs the traversed tets, e.g. for visualization
+	struct TraverseRecordTets
+	{
+		TraverseRecordTets(std::vector<int32_t>& inTraversedTets) : traversedTets(inTraversedTets) { traversedTets.clear(); }
+		void record(int32_t tetId) { traversedTets.push_back(tetId); }
+
+		std::vector<int32_t>& traversedTets;
+	};
+}
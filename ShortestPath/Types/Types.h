@@ -32,11 +32,16 @@ namespace SP {
 	typedef Eigen::Matrix<IdType, 4, Eigen::Dynamic> TTetIdsMat;
 	typedef Eigen::Matrix<IdType, 2, Eigen::Dynamic> Mat2xI;
 	typedef Eigen::Matrix<FloatingType, POINT_VEC_DIMS, Eigen::Dynamic> TVerticesMat;
+	// 3 x N view of 16 byte aligned xyz_ float vertices, e.g. an array of embree::Vec3fa
+	typedef Eigen::Map<Eigen::Matrix<float, POINT_VEC_DIMS, Eigen::Dynamic>, Eigen::Aligned16, Eigen::OuterStride<4>> TAlignedVerticesMap;
 	typedef Eigen::Matrix<FloatingType, Eigen::Dynamic, 1> VecDynamic;
 	typedef Eigen::Matrix<IdType, Eigen::Dynamic, 1> VecDynamicI;
 	// on GPU the size of bool is 8 bits
 	typedef Eigen::Matrix<int8_t, Eigen::Dynamic, 1> VecDynamicBool;
 	typedef Eigen::Matrix<IdType, 3, Eigen::Dynamic> FaceVIdsMat;
+	// 4 planes (normal + offset) per column, stored in SoA order: 4 x nx, 4 x ny, 4 x nz, 4 x d
+	typedef Eigen::Matrix<FloatingType, 16, Eigen::Dynamic> TPlanes4Mat;
+	typedef TPlanes4Mat TTetFacePlanesMat;
 
 	using Vec4BlockI = Eigen::Block<TTetIdsMat, 4, 1>;
 	using Vec3Block = Eigen::Block<TVerticesMat, 3, 1>;
@@ -2,8 +2,197 @@
 #include "ShortestPath/CollisionDetector/DiscreteCollisionDetector.h"
 #include "ShortestPath/TetMesh/TetMeshFEM.h"
 
+#include <map>
+#include <array>
+#include <string>
+#include <functional>
+#include <cmath>
+
 using namespace SP;
 
+// whether a shortest path is found and the closest surface point, for each (step, query vertex, intersected mesh, intersected tet)
+typedef std::map<std::array<int32_t, 4>, std::pair<bool, std::array<float, 3>>> ClosestPoints;
+
+// the queries run at 2 steps: at the current vertex positions, then after a shear of the mesh refitting the BVH, so that the
+// modes starting from the last step are checked too; the vertex positions are restored afterwards
+const int32_t numTestSteps = 2;
+
+void shearMesh(TetMeshFEM::SharedPtr pMesh)
+{
+	pMesh->mVertPos.row(0) += 0.05f * pMesh->mVertPos.row(1);
+}
+
+ClosestPoints batchClosestPoints(const CollisionDetectionParamters& params, TetMeshFEM::SharedPtr pMesh)
+{
+	TVerticesMat vertPos = pMesh->mVertPos;
+	// the detector keeps a reference to params
+	DiscreteCollisionDetector dcd(params);
+	dcd.initialize({ pMesh });
+
+	ClosestPoints closestPoints;
+	for (int32_t iStep = 0; iStep < numTestSteps; iStep++)
+	{
+		if (iStep)
+		{
+			shearMesh(pMesh);
+		}
+		dcd.updateBVH(RTC_BUILD_QUALITY_REFIT, RTC_BUILD_QUALITY_REFIT, true);
+
+		BatchCollisionDetectionResult batchResult;
+		dcd.detectAll({ 0 }, batchResult);
+
+		for (int32_t vId = 0; vId < pMesh->numVertices(); vId++)
+		{
+			int32_t iQuery = batchResult.queryId(0, vId);
+			for (int32_t iRecord = batchResult.queryOffsets[iQuery]; iRecord < batchResult.queryOffsets[iQuery + 1]; iRecord++)
+			{
+				closestPoints[{ iStep, vId, batchResult.intersectedTMeshIds[iRecord], batchResult.intersectedTets[iRecord] }] =
+					{ bool(batchResult.shortestPathFound[iRecord]), batchResult.closestSurfacePts[iRecord] };
+			}
+		}
+	}
+	pMesh->mVertPos = vertPos;
+	return closestPoints;
+}
+
+ClosestPoints perVertexClosestPoints(const CollisionDetectionParamters& params, TetMeshFEM::SharedPtr pMesh)
+{
+	TVerticesMat vertPos = pMesh->mVertPos;
+	DiscreteCollisionDetector dcd(params);
+	dcd.initialize({ pMesh });
+
+	ClosestPoints closestPoints;
+	for (int32_t iStep = 0; iStep < numTestSteps; iStep++)
+	{
+		if (iStep)
+		{
+			shearMesh(pMesh);
+		}
+		dcd.updateBVH(RTC_BUILD_QUALITY_REFIT, RTC_BUILD_QUALITY_REFIT, true);
+
+		for (int32_t vId = 0; vId < pMesh->numVertices(); vId++)
+		{
+			CollisionDetectionResult colDecResult;
+			dcd.vertexCollisionDetection(vId, 0, &colDecResult);
+			ClosestPointQueryResult queryResult;
+			dcd.closestPointQuery(&colDecResult, &queryResult);
+			for (int32_t iIntersection = 0; iIntersection < colDecResult.numIntersections(); iIntersection++)
+			{
+				closestPoints[{ iStep, vId, colDecResult.intersectedTMeshIds[iIntersection], colDecResult.intersectedTets[iIntersection] }] =
+					{ bool(colDecResult.shortestPathFound[iIntersection]), colDecResult.closestSurfacePts[iIntersection] };
+			}
+		}
+	}
+	pMesh->mVertPos = vertPos;
+	return closestPoints;
+}
+
+// number of intersections found by only one of the queries, or whose closest points differ by more than the float rounding of
+// the SIMD kernels; the closest faces are not compared, they may differ where several faces share the closest point
+int32_t numMismatches(const ClosestPoints& reference, const ClosestPoints& closestPoints)
+{
+	int32_t numMismatches = 0;
+	for (const auto& intersection : reference)
+	{
+		ClosestPoints::const_iterator iOther = closestPoints.find(intersection.first);
+		if (iOther == closestPoints.end() || iOther->second.first != intersection.second.first)
+		{
+			++numMismatches;
+			continue;
+		}
+		for (int iDim = 0; iDim < 3; iDim++)
+		{
+			float a = intersection.second.second[iDim];
+			if (std::abs(iOther->second.second[iDim] - a) > 1e-4f * (1.f + std::abs(a)))
+			{
+				++numMismatches;
+				break;
+			}
+		}
+	}
+	for (const auto& intersection : closestPoints)
+	{
+		numMismatches += reference.find(intersection.first) == reference.end();
+	}
+	return numMismatches;
+}
+
+// compares the closest points of the per vertex query, of the batch query on the mesh reordered for locality and of the batch
+// query with each optional mode of the collision detector turned on with the ones of the batch query with the reference
+// parameters, for each tetrahedral traverse; pReorderedMesh is the same mesh initialized with ObjectParams::reorderForLocality
+// returns the number of mismatching modes which are documented to give the same closest points
+int checkParameterVariants(const CollisionDetectionParamters& referenceParams, TetMeshFEM::SharedPtr pMesh,
+	TetMeshFEM::SharedPtr pReorderedMesh)
+{
+	struct ParameterVariant
+	{
+		std::string name;
+		std::function<void(CollisionDetectionParamters&)> apply;
+		// documented to give the same closest points as the reference parameters
+		bool sameResults;
+	};
+
+	const std::vector<ParameterVariant> traverses = {
+		{ "static traverse", [](CollisionDetectionParamters& p) { p.useStaticTraverse = true; p.loopLessTraverse = false; }, true },
+		{ "dynamic traverse", [](CollisionDetectionParamters& p) { p.useStaticTraverse = false; p.loopLessTraverse = false; }, true },
+		{ "loop less traverse", [](CollisionDetectionParamters& p) { p.loopLessTraverse = true; }, true },
+	};
+	const std::vector<ParameterVariant> variants = {
+		{ "twoPhaseBatchQuery", [](CollisionDetectionParamters& p) { p.twoPhaseBatchQuery = true; }, true },
+		{ "leafBatchedClosestPoint", [](CollisionDetectionParamters& p) { p.leafBatchedClosestPoint = true; }, true },
+		{ "useTetFacePlanePrimitive", [](CollisionDetectionParamters& p) { p.useTetFacePlanePrimitive = true; }, true },
+		{ "cacheTetGeometry", [](CollisionDetectionParamters& p) { p.cacheTetGeometry = true; }, true },
+		{ "cacheSurfaceNormals", [](CollisionDetectionParamters& p) { p.cacheSurfaceNormals = true; }, true },
+		{ "useFeasibleRegionTable", [](CollisionDetectionParamters& p) { p.useFeasibleRegionTable = true; }, true },
+		{ "leafBatchedClosestPoint normalConePruning",
+			[](CollisionDetectionParamters& p) { p.leafBatchedClosestPoint = true; p.normalConePruning = true; }, true },
+		{ "lazyClosestPointValidation", [](CollisionDetectionParamters& p) { p.lazyClosestPointValidation = true; }, true },
+		{ "warmStartEmbracingTets", [](CollisionDetectionParamters& p) { p.warmStartEmbracingTets = true; }, false },
+		{ "warmStartClosestPointRadius", [](CollisionDetectionParamters& p) { p.warmStartClosestPointRadius = true; }, true },
+		{ "cacheTraversalVerdicts", [](CollisionDetectionParamters& p) { p.cacheTraversalVerdicts = true; }, false },
+		{ "twoPhaseBatchQuery groupQueriesByEmbracingTet",
+			[](CollisionDetectionParamters& p) { p.twoPhaseBatchQuery = true; p.groupQueriesByEmbracingTet = true; }, true },
+		{ "exactTraversedTets", [](CollisionDetectionParamters& p) { p.exactTraversedTets = true; }, true },
+		{ "packedTetTopology", [](CollisionDetectionParamters& p) { p.packedTetTopology = true; }, true },
+		{ "alignedVertexStorage", [](CollisionDetectionParamters& p) { p.alignedVertexStorage = true; }, true },
+		{ "simdExitFaceKernel", [](CollisionDetectionParamters& p) { p.simdExitFaceKernel = true; }, true },
+		{ "pluckerTraverse", [](CollisionDetectionParamters& p) { p.pluckerTraverse = true; }, false },
+		{ "lazyClosestPointValidation packetTraverse",
+			[](CollisionDetectionParamters& p) { p.lazyClosestPointValidation = true; p.packetTraverse = true; }, true },
+		{ "lazyClosestPointValidation twoPhaseBatchQuery wavefrontTraverse", [](CollisionDetectionParamters& p) {
+			p.lazyClosestPointValidation = true; p.twoPhaseBatchQuery = true; p.wavefrontTraverse = true; }, true },
+		{ "bestFirstBranchOrder", [](CollisionDetectionParamters& p) { p.bestFirstBranchOrder = true; }, false },
+	};
+
+	int numInconsistentVariants = 0;
+	for (const ParameterVariant& traverse : traverses)
+	{
+		CollisionDetectionParamters traverseParams = referenceParams;
+		traverse.apply(traverseParams);
+		ClosestPoints reference = batchClosestPoints(traverseParams, pMesh);
+		std::cout << traverse.name << ": " << reference.size() << " intersections\n";
+
+		int32_t numPerVertexMismatches = numMismatches(reference, perVertexClosestPoints(traverseParams, pMesh));
+		std::cout << "    per vertex query: " << numPerVertexMismatches << " mismatches\n";
+		numInconsistentVariants += numPerVertexMismatches != 0;
+
+		int32_t numReorderedMismatches = numMismatches(reference, batchClosestPoints(traverseParams, pReorderedMesh));
+		std::cout << "    reorderForLocality: " << numReorderedMismatches << " mismatches\n";
+		numInconsistentVariants += numReorderedMismatches != 0;
+
+		for (const ParameterVariant& variant : variants)
+		{
+			CollisionDetectionParamters variantParams = traverseParams;
+			variant.apply(variantParams);
+			int32_t numVariantMismatches = numMismatches(reference, batchClosestPoints(variantParams, pMesh));
+			std::cout << "    " << variant.name << ": " << numVariantMismatches << " mismatches"
+				<< (numVariantMismatches && !variant.sameResults ? " (may differ)" : "") << "\n";
+			numInconsistentVariants += numVariantMismatches && variant.sameResults;
+		}
+	}
+	return numInconsistentVariants;
+}
+
 int main(int argc, char ** argv) 
 {
 	if (argc < 3)
@@ -34,8 +223,29 @@ int main(int argc, char ** argv)
 	// if the rebuild quality is set to refit then the BVH will not be reconstructed
 	dcd.updateBVH(RTC_BUILD_QUALITY_REFIT, RTC_BUILD_QUALITY_REFIT, true);
 
-	// collision detection and shortest path find
+	// collision detection and shortest path find for all the vertices of the mesh, in parallel
 	int meshId = 0;
+	BatchCollisionDetectionResult batchResult;
+	dcd.detectAll({ meshId }, batchResult);
+
+	std::cout << "Number of intersections found: " << batchResult.size() << "\n";
+	for (int32_t vId = 0; vId < pMesh->numVertices(); vId++)
+	{
+		// the intersections of each query vertex are stored contiguously
+		int32_t iQuery = batchResult.queryId(0, vId);
+		for (int32_t iRecord = batchResult.queryOffsets[iQuery]; iRecord < batchResult.queryOffsets[iQuery + 1]; iRecord++)
+		{
+			std::cout << "    Intersection found for vertex: " << vId
+				<< " | intersecting tet: " << batchResult.intersectedTets[iRecord]
+				<< " | closest point: " << batchResult.closestSurfacePts[iRecord][0] << " "
+				<< batchResult.closestSurfacePts[iRecord][1] << " "
+				<< batchResult.closestSurfacePts[iRecord][2]
+				<< " | from surface face: " << batchResult.closestSurfaceFaceId[iRecord]
+				<< "\n";
+		}
+	}
+
+	// collision detection and shortest path find for a single vertex
 	for (size_t iV = 0; iV < pMesh->numVertices(); iV++)
 	{
 		CollisionDetectionResult colDecResult;
@@ -61,4 +271,16 @@ int main(int argc, char ** argv)
 		}
 	}
 
+	// the same mesh renumbered for memory locality, the collision detector takes and returns its original ids
+	ObjectParams::SharedPtr pReorderedObjParams = std::make_shared<ObjectParams>();
+	pReorderedObjParams->reorderForLocality = true;
+	TetMeshFEM::SharedPtr pReorderedMesh = std::make_shared<TetMeshFEM>();
+	pReorderedMesh->initialize(pReorderedObjParams, pMeshMF);
+	pReorderedMesh->vertexByOriginalId(0)(0) += 0.01;
+
+	// the optional modes of the collision detector must not change the closest points, except those documented otherwise
+	int numInconsistentVariants = checkParameterVariants(params, pMesh, pReorderedMesh);
+	std::cout << "Number of inconsistent parameter variants: " << numInconsistentVariants << "\n";
+
+	return numInconsistentVariants ? 1 : 0;
 }
\ No newline at end of file